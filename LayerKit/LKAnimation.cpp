@@ -24,6 +24,7 @@
 #include <boost/foreach.hpp>
 #include <boost/shared_ptr.hpp>
 #include <iostream>
+#include "LKAnimationScheduler.h"
 #include "LKlayer.h"
 #include "LKEngine.h"
 #include "LKUtil.h"
@@ -35,6 +36,25 @@ using boost::bind;
 #define foreach BOOST_FOREACH
 
 
+/** eases from start to target over duration ticks along the LKEasing
+ *  curve easing, writing the value dtick ticks in to out. Returns true
+ *  once the target is reached */
+template <typename T>
+inline bool interpolate(const T& start, const T& target, int dtick, int duration, int easing, T& out)
+{
+	if (dtick > duration){
+		out = target;
+		return true;
+	}
+	double nd = dtick / float(duration); // normalised delta
+	double v  = LKEasing::evaluate(easing, nd);
+	// Coord's arithmetic operators are not const
+	T s = start;
+	T d = target;
+	out = s + (d - s) * v;
+	return false;
+}
+
 template <typename T>
 inline T sclip(const T& v, const T& min, const T& max)
 {
@@ -53,10 +73,23 @@ inline T sclip(const T& v, const T& min, const T& max)
 /********************************************************************/
 LKAnimatable::LKAnimatable(LKAnimator* animator, bool autoCleanup)
 	: m_animator(animator)
+	, m_autoCleanup(autoCleanup)
 	, m_isRunning(false)
+	, m_scheduler(NULL)
+	, m_scheduleIndex(-1)
+	, m_track(-1)
+	, m_animatorIndex(-1)
 {
 }
 
+LKAnimatable::~LKAnimatable(void)
+{
+	if (m_scheduler != NULL)
+		m_scheduler->remove(this);
+	if (m_animatorIndex >= 0)
+		m_animator->detachPropertyAnimator(this);
+}
+
 void LKAnimatable::start(void)
 {
 	if (m_isRunning)
@@ -65,6 +98,11 @@ void LKAnimatable::start(void)
 	m_animator->addPropertyAnimator(this);
 }
 
+int LKAnimatable::addTrack(LKAnimationTracks&)
+{
+	return -1;
+}
+
 bool LKAnimatable::isRunning(void) const
 {
 	return m_isRunning;
@@ -72,9 +110,12 @@ bool LKAnimatable::isRunning(void) const
 
 void LKAnimatable::stop(void)
 {
-	if (m_isRunning)
-		m_animator->removePropertyAnimator(this);
+	if (!m_isRunning)
+		return;
+	// the animator may free this animation, so it must be the last
+	// thing touched
 	m_isRunning = false;
+	m_animator->removePropertyAnimator(this);
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -82,6 +123,7 @@ void LKAnimatable::stop(void)
 LKAnimation::LKAnimation(LKAnimator* animator, bool autoCleanup)
 	: LKAnimatable(animator, autoCleanup)
 	, m_startTicks(LKEngine::getTicks())
+	, m_easing(LKEasing::COSINE)
 { 
 }
 
@@ -89,6 +131,18 @@ LKAnimation::~LKAnimation(void)
 {
 }
 
+int LKAnimation::easing(void) const
+{
+	return m_easing;
+}
+
+void LKAnimation::setEasing(int curve)
+{
+	m_easing = curve;
+	if (m_track >= 0)
+		m_scheduler->tracks().setEasing(m_track, curve);
+}
+
 void LKAnimation::start(void)
 {
 	if (m_isRunning)
@@ -132,26 +186,140 @@ void LKPropertyBaseAnimator<T>::reset(T value)
 template <typename T>
 bool LKPropertyBaseAnimator<T>::update(int ticks)
 {
-	int dtick = ticks - m_startTicks;
-	
-	if (dtick > m_duration){
-		m_setDelegate(m_targetValue);
-		return true;
-	} else {
-		double nd = dtick / float(m_duration); // normalised delta 
-		double v  = (1 - cos(nd * M_PI)) / 2;
-		T      r  = m_startValue + (m_targetValue - m_startValue) * v;
-		m_setDelegate(r);
-	}
-
-	return false;
+	T    r;
+	bool isDone = interpolate(m_startValue, m_targetValue, ticks - m_startTicks, m_duration, m_easing, r);
+	m_setDelegate(r);
+	return isDone;
 }
 
 template struct LKPropertyBaseAnimator<Coord2d>;
+template struct LKPropertyBaseAnimator<Coord3d>;
 template struct LKPropertyBaseAnimator<double>;
 
 ////////////////////////////////////////////////////////////////////
 
+const Coord3d& LKLayerPosition::get(const LKLayer* layer)
+{
+	return layer->position();
+}
+
+void LKLayerPosition::set(LKLayer* layer, const Coord3d& v)
+{
+	layer->positionRef() = v;
+	layer->invalidateTransform();
+}
+
+const Coord3d& LKLayerPositionOffset::get(const LKLayer* layer)
+{
+	return layer->positionOffset();
+}
+
+void LKLayerPositionOffset::set(LKLayer* layer, const Coord3d& v)
+{
+	layer->positionOffsetRef() = v;
+	layer->invalidateTransform();
+}
+
+const Coord3d& LKLayerRotation::get(const LKLayer* layer)
+{
+	return layer->rotation();
+}
+
+void LKLayerRotation::set(LKLayer* layer, const Coord3d& v)
+{
+	layer->rotationRef() = v;
+	layer->invalidateTransform();
+}
+
+const Coord3d& LKLayerScale::get(const LKLayer* layer)
+{
+	return layer->scale();
+}
+
+void LKLayerScale::set(LKLayer* layer, const Coord3d& v)
+{
+	layer->scaleRef() = v;
+	layer->invalidateTransform();
+}
+
+double LKLayerOpacity::get(const LKLayer* layer)
+{
+	return layer->opacity();
+}
+
+void LKLayerOpacity::set(LKLayer* layer, const double& v)
+{
+	layer->opacityRef() = v;
+}
+
+////////////////////////////////////////////////////////////////////
+
+template <typename Property>
+LKLayerPropertyAnimator<Property>::LKLayerPropertyAnimator(LKAnimator* animator,
+														   LKLayer* layer,
+														   T targetValue,
+														   int duration)
+	: LKAnimation(animator)
+	, m_layer(layer)
+	, m_startValue(Property::get(layer))
+	, m_targetValue(targetValue)
+	, m_duration(duration)
+{
+}
+
+static inline Coord3d trackValue(const Coord3d& v)
+{
+	return v;
+}
+
+static inline Coord3d trackValue(double v)
+{
+	return Coord3d(v, 0, 0);
+}
+
+template <typename Property>
+void LKLayerPropertyAnimator<Property>::reset(T value)
+{
+	m_startValue  = Property::get(m_layer);
+	m_targetValue = value;
+	m_startTicks  = LKEngine::getTicks();
+	if (m_track >= 0)
+		m_scheduler->tracks().retarget(m_track, trackValue(m_startValue), trackValue(m_targetValue), m_startTicks);
+}
+
+template <typename Property>
+void LKLayerPropertyAnimator<Property>::retarget(T start, T target)
+{
+	m_startValue  = start;
+	m_targetValue = target;
+	if (m_track >= 0)
+		m_scheduler->tracks().retarget(m_track, trackValue(m_startValue), trackValue(m_targetValue), m_startTicks);
+}
+
+template <typename Property>
+int LKLayerPropertyAnimator<Property>::addTrack(LKAnimationTracks& tracks)
+{
+	return tracks.add(this, m_layer, Property::ID, trackValue(m_startValue), trackValue(m_targetValue),
+					  m_startTicks, m_duration, m_easing);
+}
+
+template <typename Property>
+bool LKLayerPropertyAnimator<Property>::update(int ticks)
+{
+	T    r;
+	bool isDone = interpolate(m_startValue, m_targetValue, ticks - m_startTicks, m_duration, m_easing, r);
+	Property::set(m_layer, r);
+	return isDone;
+}
+
+template struct LKLayerPropertyAnimator<LKLayerPosition>;
+template struct LKLayerPropertyAnimator<LKLayerPositionOffset>;
+template struct LKLayerPropertyAnimator<LKLayerRotation>;
+template struct LKLayerPropertyAnimator<LKLayerScale>;
+template struct LKLayerPropertyAnimator<LKLayerOpacity>;
+
+////////////////////////////////////////////////////////////////////
+
 LKRandomGyrationAnimator::LKRandomGyrationAnimator(LKAnimator* animator, 
 	GetPropertyDelegate getDelegate, SetPropertyDelegate setDelegate,
 	double xmin, double xmax, double ymin, double ymax, double zmin, double zmax)
@@ -204,36 +372,68 @@ LKAnimator::LKAnimator(LKLayer* target)
 	, m_rotationAnimator(NULL)
 	, m_scaleAnimator(NULL)
 	, m_opacityAnimator(NULL)
-    , m_position(target->m_position)
-    , m_rotation(target->m_rotation)
+    , m_position(target->position())
+    , m_rotation(target->rotation())
     , m_positionflag(false, false, false)
     , m_rotationflag(false, false, false)
+    , m_scaleflag(false, false, false)
+	, m_isUpdating(false)
+	, m_hasRemovals(false)
+	, m_scheduler(NULL)
 {
-	m_opacityAnimator = new LKDoubleAnimator(
-							this,
-							boost::bind(&LKLayer::opacity, m_target),
-							boost::bind(&LKLayer::setOpacity, m_target, _1),
-							m_target->opacity(),
-							1500);
-	m_positionAnimator = new LKCoord3dAnimator(
-							this,
-							boost::bind(&LKLayer::position, m_target),
-							boost::bind(&LKAnimator::setlayerPosition, this, _1),
-							m_target->m_position);
-	m_rotationAnimator = new LKCoord3dAnimator(
-							this,
-							boost::bind(&LKLayer::rotation, m_target),
-							boost::bind(&LKAnimator::setLayerRotation, this, _1),
-							m_target->m_rotation);
-	m_scaleAnimator = new LKCoord3dAnimator(
-						this,
-						boost::bind(&LKLayer::scale, m_target),
-						boost::bind(&LKAnimator::setLayerScale, this, _1),
-						m_target->m_scale);
 }
 
 LKAnimator::~LKAnimator(void)
 {
+	std::vector<LKAnimatable*> animations;
+	animations.swap(m_propertyAnimations);
+	foreach (LKAnimatable* anim, animations){
+		if (anim == NULL)
+			continue;
+		anim->m_isRunning     = false;
+		anim->m_animatorIndex = -1;
+		if (anim->m_scheduler != NULL)
+			anim->m_scheduler->remove(anim);
+		if (anim->m_autoCleanup)
+			delete anim;
+		else
+			anim->m_self.reset();
+	}
+	foreach (LKAnimation* anim, m_ownedAnimations)
+		delete anim;
+
+	delete m_positionAnimator;
+	delete m_rotationAnimator;
+	delete m_scaleAnimator;
+	delete m_opacityAnimator;
+}
+
+LKOpacityAnimator* LKAnimator::opacityAnimator(void)
+{
+	if (m_opacityAnimator == NULL)
+		m_opacityAnimator = new LKOpacityAnimator(this, m_target, m_target->opacity(), 1500);
+	return m_opacityAnimator;
+}
+
+LKPositionAnimator* LKAnimator::positionAnimator(void)
+{
+	if (m_positionAnimator == NULL)
+		m_positionAnimator = new LKPositionAnimator(this, m_target, m_target->position());
+	return m_positionAnimator;
+}
+
+LKRotationAnimator* LKAnimator::rotationAnimator(void)
+{
+	if (m_rotationAnimator == NULL)
+		m_rotationAnimator = new LKRotationAnimator(this, m_target, m_target->rotation());
+	return m_rotationAnimator;
+}
+
+LKScaleAnimator* LKAnimator::scaleAnimator(void)
+{
+	if (m_scaleAnimator == NULL)
+		m_scaleAnimator = new LKScaleAnimator(this, m_target, m_target->scale());
+	return m_scaleAnimator;
 }
 
 const Coord3d& LKAnimator::position(void) const
@@ -243,17 +443,18 @@ const Coord3d& LKAnimator::position(void) const
 
 void LKAnimator::setPosition(const Coord3d& pos)
 {	
-	if (m_target->m_position == pos){
-		if (m_positionAnimator->isRunning())
+	if (m_target->position() == pos){
+		if (m_positionAnimator != NULL && m_positionAnimator->isRunning())
 			m_positionAnimator->stop();
 		return;
 	}
 
+	positionAnimator();
+
 	if (m_positionAnimator->isRunning() && m_positionAnimator->m_targetValue == pos)
 		return;
 
-	m_positionAnimator->m_startValue  = m_target->m_position;
-	m_positionAnimator->m_targetValue = pos;
+	m_positionAnimator->retarget(m_target->position(), pos);
 
 	if (!m_positionAnimator->isRunning())
 		m_positionAnimator->start();
@@ -289,16 +490,18 @@ const Coord3d& LKAnimator::rotation(void) const
 
 void LKAnimator::setRotation(const Coord3d& rot)
 {	
-	if (m_target->m_rotation == rot){
-		m_rotationAnimator->stop();
+	if (m_target->rotation() == rot){
+		if (m_rotationAnimator != NULL)
+			m_rotationAnimator->stop();
 		return;
 	}
 
+	rotationAnimator();
+
 	if (m_rotationAnimator->isRunning() && m_rotationAnimator->m_targetValue == rot)
 		return;
 
-	m_rotationAnimator->m_startValue  = m_target->m_rotation;
-	m_rotationAnimator->m_targetValue = rot;
+	m_rotationAnimator->retarget(m_target->rotation(), rot);
 
 	if (!m_rotationAnimator->isRunning())
 		m_rotationAnimator->start();
@@ -326,17 +529,18 @@ void LKAnimator::setScale(const double& x, const double& y, const double& z)
 
 void LKAnimator::setScale(const Coord3d& scale)
 {
-	if (m_target->m_scale == scale){
-		if (m_scaleAnimator->isRunning())
+	if (m_target->scale() == scale){
+		if (m_scaleAnimator != NULL && m_scaleAnimator->isRunning())
 			m_scaleAnimator->stop();
 		return;
 	}
 
+	scaleAnimator();
+
 	if (m_scaleAnimator->isRunning() && m_scaleAnimator->m_targetValue == scale)
 		return;
 
-	m_scaleAnimator->m_startValue  = m_target->m_scale;
-	m_scaleAnimator->m_targetValue = scale;
+	m_scaleAnimator->retarget(m_target->scale(), scale);
 
 	if (!m_scaleAnimator->isRunning())
 		m_scaleAnimator->start();
@@ -344,13 +548,14 @@ void LKAnimator::setScale(const Coord3d& scale)
 	
 void LKAnimator::setOpacity(const double v)
 {
+	opacityAnimator();
 	if (m_opacityAnimator->isRunning() && m_opacityAnimator->m_targetValue == v)
 		return;
 
 	if (m_opacityAnimator->isRunning())
 		m_opacityAnimator->stop();
 	
-	if (m_target->m_opacity == v)
+	if (m_target->opacity() == v)
 		return;
 
 	m_opacityAnimator->reset(v);
@@ -359,47 +564,59 @@ void LKAnimator::setOpacity(const double v)
 	
 LKAnimatable* LKAnimator::positionAnimation(void) const
 {
-	return m_positionAnimator;
+	return const_cast<LKAnimator*>(this)->positionAnimator();
 }
 	
 void LKAnimator::setlayerPosition(const Coord3d& pos)
 {
-    m_target->m_position = pos;
+    m_target->positionRef() = pos;
+	m_target->invalidateTransform();
 }
 
 void LKAnimator::setlayerPosition(const double& x, const double& y, const double& z)
 {	
-    m_target->m_position.set(x, y, z);
+    m_target->positionRef().set(x, y, z);
+	m_target->invalidateTransform();
 }
 
 void LKAnimator::setLayerRotation(const Coord3d& rot)
 {
-    m_target->m_rotation = rot;
+    m_target->rotationRef() = rot;
+	m_target->invalidateTransform();
 }
 
 void LKAnimator::setLayerRotation(const double& x, const double& y, const double& z)
 {
-    m_target->m_rotation.set(x, y, z);
+    m_target->rotationRef().set(x, y, z);
+	m_target->invalidateTransform();
 }
 
 void LKAnimator::setLayerScale(const Coord3d& scale)
 {
-    m_target->m_scale = scale;
+    m_target->scaleRef() = scale;
+	m_target->invalidateTransform();
 }
 
 void LKAnimator::setLayerScale(const double& x, const double& y, const double& z)
 {
-    m_target->m_scale.set(x, y, z);
+    m_target->scaleRef().set(x, y, z);
+	m_target->invalidateTransform();
 }
 
 void LKAnimator::setLayerOpacity(const double v)
 {
-	m_target->m_opacity = v;
+	m_target->opacityRef() = v;
 }
 
 void LKAnimator::addPropertyAnimator(LKAnimatable* anim)
 {
+	if (anim->m_animatorIndex >= 0)
+		return;
+	anim->m_animatorIndex = static_cast<int>(m_propertyAnimations.size());
+	anim->m_self          = anim->m_weakSelf.lock();
 	m_propertyAnimations.push_back(anim);
+	if (m_scheduler != NULL)
+		m_scheduler->add(anim);
 }
 
 LKAnimation* LKAnimator::addPropertyAnimator(LKPropertyAnimator::GetPropertyDelegate getDel,
@@ -410,17 +627,81 @@ LKAnimation* LKAnimator::addPropertyAnimator(LKPropertyAnimator::GetPropertyDele
 	//	return NULL;
 
 	LKPropertyAnimator* anim = new LKPropertyAnimator(this, getDel, setDel, targetValue);
+	m_ownedAnimations.push_back(anim);
+	anim->start();
+	return anim;
+}
+
+LKAnimationPtr LKAnimator::startPropertyAnimation(LKPropertyAnimator::GetPropertyDelegate getDel,
+												  LKPropertyAnimator::SetPropertyDelegate setDel,
+												  double targetValue)
+{
+	LKAnimationPtr anim(new LKPropertyAnimator(this, getDel, setDel, targetValue));
+	anim->m_weakSelf = anim;
 	anim->start();
 	return anim;
 }
 
 void LKAnimator::removePropertyAnimator(LKAnimatable* animation)
 {
-	list<LKAnimatable*> out;
-	foreach (LKAnimatable* anim, m_propertyAnimations)
-		if (anim != animation)
-			out.push_back(anim);
-	m_propertyAnimations = out;
+	if (animation->m_animatorIndex < 0)
+		return;
+	detachPropertyAnimator(animation);
+	if (animation->m_scheduler != NULL)
+		animation->m_scheduler->remove(animation);
+
+	if (animation->m_autoCleanup)
+		delete animation;
+	else
+		// frees the animation if nothing else refers to it
+		animation->m_self.reset();
+}
+
+void LKAnimator::detachPropertyAnimator(LKAnimatable* anim)
+{
+	int index = anim->m_animatorIndex;
+
+	if (m_isUpdating){
+		// moving animations now would make update() skip or repeat them
+		m_propertyAnimations[index] = NULL;
+		m_hasRemovals = true;
+	} else {
+		// swap the last animation into the place of the one removed
+		m_propertyAnimations[index] = m_propertyAnimations.back();
+		m_propertyAnimations[index]->m_animatorIndex = index;
+		m_propertyAnimations.pop_back();
+	}
+	// cleared last, as anim may have been the last animation
+	anim->m_animatorIndex = -1;
+}
+
+void LKAnimator::compactPropertyAnimators(void)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < m_propertyAnimations.size(); i++){
+		if (m_propertyAnimations[i] == NULL)
+			continue;
+		m_propertyAnimations[n] = m_propertyAnimations[i];
+		m_propertyAnimations[n]->m_animatorIndex = static_cast<int>(n);
+		n++;
+	}
+	m_propertyAnimations.resize(n);
+	m_hasRemovals = false;
+}
+
+void LKAnimator::setScheduler(LKAnimationScheduler* scheduler)
+{
+	if (m_scheduler == scheduler)
+		return;
+	m_scheduler = scheduler;
+	foreach (LKAnimatable* anim, m_propertyAnimations){
+		if (anim == NULL)
+			continue;
+		if (scheduler != NULL)
+			scheduler->add(anim);
+		else if (anim->m_scheduler != NULL)
+			anim->m_scheduler->remove(anim);
+	}
 }
 
 /********************************************************************/
@@ -464,14 +745,21 @@ void LKLinearAnimator::update(long millisecondsPast)
 
 	// handle property animators
 	if (!m_propertyAnimations.empty()){
-		
-		std::list<LKAnimatable*> deleteList;
 		int ticks = LKEngine::getTicks();
-		
-		foreach (LKAnimatable* anim, m_propertyAnimations)
-			if (anim->update(ticks))
-				deleteList.push_back(anim);
-		foreach (LKAnimatable* anim, deleteList)
-			anim->stop();
+
+		// completed animations are stopped as they are found, leaving
+		// their slots empty until the compaction below. Animations
+		// started by the updates are appended, and are updated next time
+		m_isUpdating = true;
+		size_t count = m_propertyAnimations.size();
+		for (size_t i = 0; i < count; i++){
+			LKAnimatable* anim = m_propertyAnimations[i];
+			if (anim != NULL && anim->update(ticks))
+				anim->stop();
+		}
+		m_isUpdating = false;
+
+		if (m_hasRemovals)
+			compactPropertyAnimators();
 	}
 }
\ No newline at end of file
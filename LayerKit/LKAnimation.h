@@ -21,23 +21,27 @@
 #ifndef LKAnimation_h
 #define LKAnimation_h
 
-#include <list>
+#include <vector>
 #include <boost/shared_ptr.hpp>
 #include <boost/weak_ptr.hpp>
 #include <boost/function.hpp>
 #include "math/Coord.h"
+#include "LKAnimationTracks.h"
+#include "LKEasing.h"
+#include "LKPool.h"
 #include "platform/MathExtras.h"
-using std::list;
 
 
 // forward declarations
 class  LKLayer;
 class  LKAnimator;
+class  LKAnimationScheduler;
 struct LKAnimation;
 
 
 struct LKAnimatable {
 	LKAnimatable(LKAnimator* animator, bool autoCleanup=false);
+	virtual ~LKAnimatable(void);
 
 	/** updates the animated property. Returns true if the animation is completed */
 	virtual bool update(int ticks) = 0;	
@@ -46,9 +50,28 @@ struct LKAnimatable {
 	bool isRunning(void) const;
 	virtual void stop(void);
 
+	/** adds the animation to tracks if it can be evaluated there, in
+	 *  which case update() is no longer called by the scheduler. Returns
+	 *  the track, or -1 to be updated on its own (the default) */
+	virtual int addTrack(LKAnimationTracks& tracks);
+
 	LKAnimator* m_animator;
+	/** when set, the animator owns this animation and frees it once it
+	 *  stops */
 	bool m_autoCleanup;
 	bool m_isRunning;
+	/** for animations shared between the animator and the code that
+	 *  started them, a reference to this animation held while it runs */
+	boost::weak_ptr<LKAnimatable>   m_weakSelf;
+	boost::shared_ptr<LKAnimatable> m_self;
+	/** the scheduler updating this animation and the animation's place in
+	 *  it, or NULL and -1 */
+	LKAnimationScheduler* m_scheduler;
+	int  m_scheduleIndex;
+	int  m_track; /** the animation's track in the scheduler, or -1 */
+	/** the animation's place in the running animations of m_animator, or
+	 *  -1 while stopped */
+	int  m_animatorIndex;
 };
 
 
@@ -61,9 +84,17 @@ struct LKAnimation : public LKAnimatable {
 
 	virtual void start(void);
 
+	/** the LKEasing curve the animation follows, LKEasing::COSINE unless
+	 *  set */
+	int  easing(void) const;
+	void setEasing(int curve);
+
 	int  m_startTicks;
+	int  m_easing;
 };
 
+typedef boost::shared_ptr<LKAnimation> LKAnimationPtr;
+
 
 template <typename T>
 struct LKPropertyBaseAnimator : public LKAnimation {
@@ -74,6 +105,8 @@ struct LKPropertyBaseAnimator : public LKAnimation {
 	LKPropertyBaseAnimator(void);
 	LKPropertyBaseAnimator(LKAnimator* animator, GetPropertyDelegate getDelegate, SetPropertyDelegate setDelegate, T targetValue, int duration=1000);
 
+	LK_DECLARE_POOLED(LKPropertyBaseAnimator<T>)
+
 	void reset(T value);
 	bool update(int ticks);
 
@@ -90,6 +123,78 @@ typedef LKPropertyBaseAnimator<Coord2d> LKCoord2dAnimator;
 typedef LKPropertyBaseAnimator<Coord3d> LKCoord3dAnimator;
 
 
+/** compile time tags for the built in properties of LKLayer. Each reads
+ *  and writes its property directly, without the setter's side effects
+ *  on the layer's animator */
+struct LKLayerPosition {
+	typedef Coord3d Type;
+	static const LKLayerPropertyID ID = LAYER_POSITION;
+	static const Type& get(const LKLayer* layer);
+	static void set(LKLayer* layer, const Type& v);
+};
+
+struct LKLayerPositionOffset {
+	typedef Coord3d Type;
+	static const LKLayerPropertyID ID = LAYER_POSITION_OFFSET;
+	static const Type& get(const LKLayer* layer);
+	static void set(LKLayer* layer, const Type& v);
+};
+
+struct LKLayerRotation {
+	typedef Coord3d Type;
+	static const LKLayerPropertyID ID = LAYER_ROTATION;
+	static const Type& get(const LKLayer* layer);
+	static void set(LKLayer* layer, const Type& v);
+};
+
+struct LKLayerScale {
+	typedef Coord3d Type;
+	static const LKLayerPropertyID ID = LAYER_SCALE;
+	static const Type& get(const LKLayer* layer);
+	static void set(LKLayer* layer, const Type& v);
+};
+
+struct LKLayerOpacity {
+	typedef double Type;
+	static const LKLayerPropertyID ID = LAYER_OPACITY;
+	static Type get(const LKLayer* layer);
+	static void set(LKLayer* layer, const Type& v);
+};
+
+
+/** animates a built in property of a layer, named by a tag such as
+ *  LKLayerPosition. The property is written directly each tick rather
+ *  than through bound delegates, so use this in preference to
+ *  LKPropertyBaseAnimator for layer properties */
+template <typename Property>
+struct LKLayerPropertyAnimator : public LKAnimation {
+
+	typedef typename Property::Type T;
+
+	LKLayerPropertyAnimator(LKAnimator* animator, LKLayer* layer, T targetValue, int duration=1000);
+
+	LK_DECLARE_POOLED(LKLayerPropertyAnimator<Property>)
+
+	void reset(T value);
+	/** changes the end points of the running animation without
+	 *  restarting it */
+	void retarget(T start, T target);
+	bool update(int ticks);
+	int  addTrack(LKAnimationTracks& tracks);
+
+	LKLayer* m_layer;
+	T   m_startValue;
+	T   m_targetValue;
+	int m_duration;
+};
+
+typedef LKLayerPropertyAnimator<LKLayerPosition>       LKPositionAnimator;
+typedef LKLayerPropertyAnimator<LKLayerPositionOffset> LKPositionOffsetAnimator;
+typedef LKLayerPropertyAnimator<LKLayerRotation>       LKRotationAnimator;
+typedef LKLayerPropertyAnimator<LKLayerScale>          LKScaleAnimator;
+typedef LKLayerPropertyAnimator<LKLayerOpacity>        LKOpacityAnimator;
+
+
 /** an animator that randomly moves a 3D coordinate within a fixed range
  *  of motion */
 struct LKRandomGyrationAnimator : public LKAnimation {
@@ -123,6 +228,9 @@ public:
 	LKAnimator(LKLayer* target);
     virtual ~LKAnimator(void);
 
+	/** advances the animations of the target. The engine no longer calls
+	 *  this every frame; running animations are updated by its
+	 *  LKAnimationScheduler instead */
     virtual void update(long millisecondsPast) = 0;
 
     const Coord3d& position(void) const;
@@ -144,16 +252,47 @@ public:
 	const double opacity(void) const;
 	void setOpacity(const double v);
 
+	/** adds anim to the running animations. Adding an animation that is
+	 *  already running does nothing */
 	void addPropertyAnimator(LKAnimatable* anim);
+	/** creates and starts an animation of the property. The animation
+	 *  belongs to the animator, and the pointer returned stays valid
+	 *  until the animator is destroyed */
 	LKAnimation* addPropertyAnimator(LKPropertyAnimator::GetPropertyDelegate, 
 									 LKPropertyAnimator::SetPropertyDelegate,
 									 double targetValue);
-
+	/** creates and starts an animation of the property that is freed as
+	 *  soon as it has stopped and the caller has let go of the pointer
+	 *  returned, for animations started often */
+	LKAnimationPtr startPropertyAnimation(LKPropertyAnimator::GetPropertyDelegate,
+										  LKPropertyAnimator::SetPropertyDelegate,
+										  double targetValue);
+
+	/** removes animator from the running animations in constant time,
+	 *  freeing it if the animator owns it */
 	void removePropertyAnimator(LKAnimatable* animator);
 
+	/** sets the scheduler that updates the running animations, moving
+	 *  them to it. Set by the engine of the target layer */
+	void setScheduler(LKAnimationScheduler* scheduler);
+
 	LKAnimatable* positionAnimation(void) const;
 
 protected:
+	friend struct LKAnimatable;
+	/** takes anim out of its slot in m_propertyAnimations. During
+	 *  update() the slot is cleared instead, and compacted afterwards */
+	void detachPropertyAnimator(LKAnimatable* anim);
+	/** closes the slots cleared while updating, in one pass */
+	void compactPropertyAnimators(void);
+
+	// the property animators are created on first use, as most layers
+	// are never animated
+	LKOpacityAnimator*  opacityAnimator(void);
+	LKPositionAnimator* positionAnimator(void);
+	LKRotationAnimator* rotationAnimator(void);
+	LKScaleAnimator*    scaleAnimator(void);
+
     // the following functions should be used to set the position, orientation
     // etc of the target layer. Using these methods will ensure that the animator
     // is no reset by the accessor methods
@@ -171,10 +310,10 @@ protected:
 protected:
 	LKLayer*     m_target;
     
-	LKCoord3dAnimator* m_positionAnimator;
-	LKCoord3dAnimator* m_rotationAnimator;
-	LKCoord3dAnimator* m_scaleAnimator;
-	LKDoubleAnimator*  m_opacityAnimator;
+	LKPositionAnimator* m_positionAnimator;
+	LKRotationAnimator* m_rotationAnimator;
+	LKScaleAnimator*    m_scaleAnimator;
+	LKOpacityAnimator*  m_opacityAnimator;
 
 	Coord3d      m_position;
     Coord3d      m_rotation;
@@ -182,13 +321,21 @@ protected:
     Coord3<bool> m_positionflag;
     Coord3<bool> m_rotationflag;
     Coord3<bool> m_scaleflag;
-	list<LKAnimatable*> m_propertyAnimations;
+	std::vector<LKAnimatable*> m_propertyAnimations;
+	/** the animations made by addPropertyAnimator(), freed with the
+	 *  animator */
+	std::vector<LKAnimation*>  m_ownedAnimations;
+	bool m_isUpdating;
+	bool m_hasRemovals;
+	LKAnimationScheduler* m_scheduler;
 };
 
 
 class LKLinearAnimator : public LKAnimator {
 public:
     LKLinearAnimator(LKLayer* target);
+	LK_DECLARE_POOLED(LKLinearAnimator)
+
 	void update(long millisecondsPast);
 };
 
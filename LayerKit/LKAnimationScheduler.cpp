@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ */
+#include "LKAnimationScheduler.h"
+
+#include "LKAnimation.h"
+
+
+LKAnimationScheduler::LKAnimationScheduler(void)
+	: m_isTicking(false)
+	, m_hasRemovals(false)
+{
+}
+
+LKAnimationScheduler::~LKAnimationScheduler(void)
+{
+	for (size_t i = 0; i < m_active.size(); i++){
+		if (m_active[i] == NULL)
+			continue;
+		m_active[i]->m_scheduler     = NULL;
+		m_active[i]->m_scheduleIndex = -1;
+	}
+	while (m_tracks.size() > 0)
+		remove(m_tracks.owner(0));
+}
+
+void LKAnimationScheduler::add(LKAnimatable* anim)
+{
+	if (anim->m_scheduler == this)
+		return;
+	if (anim->m_scheduler != NULL)
+		anim->m_scheduler->remove(anim);
+	anim->m_scheduler = this;
+	anim->m_track     = anim->addTrack(m_tracks);
+	if (anim->m_track >= 0)
+		return;
+	anim->m_scheduleIndex = static_cast<int>(m_active.size());
+	m_active.push_back(anim);
+}
+
+void LKAnimationScheduler::remove(LKAnimatable* anim)
+{
+	if (anim->m_scheduler != this)
+		return;
+	anim->m_scheduler = NULL;
+	if (anim->m_track >= 0){
+		// tracks are never being iterated when animations are removed
+		m_tracks.remove(anim->m_track);
+		anim->m_track = -1;
+		return;
+	}
+
+	int index = anim->m_scheduleIndex;
+	anim->m_scheduleIndex = -1;
+
+	if (m_isTicking){
+		// moving animations now would make the tick skip or repeat them
+		m_active[index] = NULL;
+		m_hasRemovals   = true;
+		return;
+	}
+
+	// swap the last animation into the place of the one removed
+	m_active[index] = m_active.back();
+	m_active[index]->m_scheduleIndex = index;
+	m_active.pop_back();
+}
+
+void LKAnimationScheduler::tick(int ticks)
+{
+	// the tracks are evaluated in one pass before any animation is
+	// stopped, as stopping moves tracks
+	m_completed.clear();
+	m_tracks.evaluate(ticks, m_completed);
+	for (size_t i = 0; i < m_completed.size(); i++)
+		m_completed[i]->stop();
+
+	m_isTicking = true;
+	// animations started by the updates are appended, and are updated
+	// from the next tick
+	size_t count = m_active.size();
+	for (size_t i = 0; i < count; i++){
+		LKAnimatable* anim = m_active[i];
+		if (anim != NULL && anim->update(ticks))
+			anim->stop();
+	}
+	m_isTicking = false;
+
+	if (!m_hasRemovals)
+		return;
+	size_t n = 0;
+	for (size_t i = 0; i < m_active.size(); i++){
+		if (m_active[i] == NULL)
+			continue;
+		m_active[n] = m_active[i];
+		m_active[n]->m_scheduleIndex = static_cast<int>(n);
+		n++;
+	}
+	m_active.resize(n);
+	m_hasRemovals = false;
+}
+
+LKAnimationTracks& LKAnimationScheduler::tracks(void)
+{
+	return m_tracks;
+}
+
+int LKAnimationScheduler::activeCount(void) const
+{
+	int count = m_tracks.size();
+	for (size_t i = 0; i < m_active.size(); i++)
+		if (m_active[i] != NULL)
+			count++;
+	return count;
+}
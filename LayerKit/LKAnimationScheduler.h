@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ */
+#ifndef LKAnimationScheduler_h
+#define LKAnimationScheduler_h
+
+#include <vector>
+#include "LKAnimationTracks.h"
+
+
+struct LKAnimatable;
+
+
+/** the running animations of the layers attached to an engine. The
+ *  engine ticks them once per frame before rendering, whether or not
+ *  their layers are visible, so the cost of animating grows with the
+ *  number of running animations rather than the number of layers.
+ *
+ *  Animations are added when they start on a layer attached to the
+ *  engine, or when a layer with running animations is attached, and are
+ *  removed when they stop. Both are constant time. Animations of built in
+ *  layer properties are kept as LKAnimationTracks and evaluated in one
+ *  batch; the rest are updated one at a time */
+class LKAnimationScheduler {
+public:
+	LKAnimationScheduler(void);
+	/** removes the animations still scheduled */
+	~LKAnimationScheduler(void);
+
+	void add(LKAnimatable* anim);
+	void remove(LKAnimatable* anim);
+
+	/** updates every scheduled animation to ticks, stopping those that
+	 *  complete. Animations may be started and stopped by the updates */
+	void tick(int ticks);
+
+	/** the number of animations scheduled */
+	int activeCount(void) const;
+	LKAnimationTracks& tracks(void);
+
+private:
+	// schedulers are not copyable
+	LKAnimationScheduler(const LKAnimationScheduler&);
+	LKAnimationScheduler& operator=(const LKAnimationScheduler&);
+
+	/** the scheduled animations. While ticking, removed animations leave
+	 *  a NULL behind, which is compacted away once the tick is done */
+	std::vector<LKAnimatable*> m_active;
+	LKAnimationTracks m_tracks;
+	std::vector<LKAnimatable*> m_completed;
+	bool m_isTicking;
+	bool m_hasRemovals;
+};
+
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ */
+#include "LKAnimationTracks.h"
+
+#include <algorithm>
+#include "LKAnimation.h"
+#include "LKEasing.h"
+#include "LKLayer.h"
+
+
+int LKAnimationTracks::add(LKAnimatable* owner, LKLayer* layer, LKLayerPropertyID property,
+						   const Coord3d& start, const Coord3d& target, int startTicks, int duration, int easing)
+{
+	m_startX.push_back(start.x);
+	m_startY.push_back(start.y);
+	m_startZ.push_back(start.z);
+	m_targetX.push_back(target.x);
+	m_targetY.push_back(target.y);
+	m_targetZ.push_back(target.z);
+	m_startTicks.push_back(startTicks);
+	// a zero duration would divide zero by zero on the first tick
+	m_durations.push_back(std::max(duration, 1));
+	m_easing.push_back(easing);
+	m_properties.push_back(static_cast<unsigned char>(property));
+	m_layers.push_back(layer);
+	m_owners.push_back(owner);
+	return size() - 1;
+}
+
+/** moves the element at from into to and drops the last element */
+template <typename T>
+static inline void moveLast(std::vector<T>& v, int to)
+{
+	v[to] = v.back();
+	v.pop_back();
+}
+
+void LKAnimationTracks::remove(int track)
+{
+	moveLast(m_startX, track);
+	moveLast(m_startY, track);
+	moveLast(m_startZ, track);
+	moveLast(m_targetX, track);
+	moveLast(m_targetY, track);
+	moveLast(m_targetZ, track);
+	moveLast(m_startTicks, track);
+	moveLast(m_durations, track);
+	moveLast(m_easing, track);
+	moveLast(m_properties, track);
+	moveLast(m_layers, track);
+	moveLast(m_owners, track);
+	if (track < size())
+		m_owners[track]->m_track = track;
+}
+
+void LKAnimationTracks::retarget(int track, const Coord3d& start, const Coord3d& target, int startTicks)
+{
+	m_startTicks[track] = startTicks;
+	m_startX[track]  = start.x;
+	m_startY[track]  = start.y;
+	m_startZ[track]  = start.z;
+	m_targetX[track] = target.x;
+	m_targetY[track] = target.y;
+	m_targetZ[track] = target.z;
+}
+
+void LKAnimationTracks::setEasing(int track, int easing)
+{
+	m_easing[track] = easing;
+}
+
+int LKAnimationTracks::size(void) const
+{
+	return static_cast<int>(m_owners.size());
+}
+
+LKAnimatable* LKAnimationTracks::owner(int track) const
+{
+	return m_owners[track];
+}
+
+void LKAnimationTracks::evaluate(int ticks, std::vector<LKAnimatable*>& completed)
+{
+	const int n = size();
+	if (n == 0)
+		return;
+
+	m_valueX.resize(n);
+	m_valueY.resize(n);
+	m_valueZ.resize(n);
+	m_isDone.resize(n);
+	m_eased.resize(n);
+	interpolate(ticks);
+
+	for (int i = 0; i < n; i++){
+		LKLayer* layer = m_layers[i];
+		switch (m_properties[i]){
+		case LAYER_POSITION:
+			LKLayerPosition::set(layer, Coord3d(m_valueX[i], m_valueY[i], m_valueZ[i]));
+			break;
+		case LAYER_POSITION_OFFSET:
+			LKLayerPositionOffset::set(layer, Coord3d(m_valueX[i], m_valueY[i], m_valueZ[i]));
+			break;
+		case LAYER_ROTATION:
+			LKLayerRotation::set(layer, Coord3d(m_valueX[i], m_valueY[i], m_valueZ[i]));
+			break;
+		case LAYER_SCALE:
+			LKLayerScale::set(layer, Coord3d(m_valueX[i], m_valueY[i], m_valueZ[i]));
+			break;
+		case LAYER_OPACITY:
+			LKLayerOpacity::set(layer, m_valueX[i]);
+			break;
+		}
+		if (m_isDone[i])
+			completed.push_back(m_owners[i]);
+	}
+}
+
+void LKAnimationTracks::interpolate(double ticks)
+{
+	const int n = size();
+
+	// the curves are read from tables one track at a time, and the
+	// values are then blended in a second, vectorised pass
+	for (int i = 0; i < n; i++){
+		double dtick = ticks - m_startTicks[i];
+		m_isDone[i] = dtick > m_durations[i];
+		m_eased[i]  = LKEasing::evaluate(m_easing[i], dtick / m_durations[i]);
+	}
+
+	int i = 0;
+#ifdef LK_COORD_SSE
+	const __m128d now = _mm_set1_pd(ticks);
+	for (; i + 2 <= n; i += 2){
+		__m128d dtick  = _mm_sub_pd(now, _mm_loadu_pd(&m_startTicks[i]));
+		__m128d isDone = _mm_cmpgt_pd(dtick, _mm_loadu_pd(&m_durations[i]));
+		__m128d v      = _mm_loadu_pd(&m_eased[i]);
+
+		const double* starts[3]  = {&m_startX[i], &m_startY[i], &m_startZ[i]};
+		const double* targets[3] = {&m_targetX[i], &m_targetY[i], &m_targetZ[i]};
+		double*       values[3]  = {&m_valueX[i], &m_valueY[i], &m_valueZ[i]};
+		for (int c = 0; c < 3; c++){
+			__m128d start  = _mm_loadu_pd(starts[c]);
+			__m128d target = _mm_loadu_pd(targets[c]);
+			__m128d value  = _mm_add_pd(start, _mm_mul_pd(_mm_sub_pd(target, start), v));
+			// completed tracks land exactly on their targets
+			value = _mm_or_pd(_mm_and_pd(isDone, target), _mm_andnot_pd(isDone, value));
+			_mm_storeu_pd(values[c], value);
+		}
+	}
+#endif
+
+	for (; i < n; i++){
+		bool   isDone = m_isDone[i] != 0;
+		double v      = m_eased[i];
+		m_valueX[i] = isDone ? m_targetX[i] : m_startX[i] + (m_targetX[i] - m_startX[i]) * v;
+		m_valueY[i] = isDone ? m_targetY[i] : m_startY[i] + (m_targetY[i] - m_startY[i]) * v;
+		m_valueZ[i] = isDone ? m_targetZ[i] : m_startZ[i] + (m_targetZ[i] - m_startZ[i]) * v;
+	}
+}
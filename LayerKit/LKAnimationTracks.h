@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ */
+#ifndef LKAnimationTracks_h
+#define LKAnimationTracks_h
+
+#include <vector>
+#include "math/Coord.h"
+
+
+class  LKLayer;
+struct LKAnimatable;
+
+
+/** the built in layer properties that tracks can animate */
+enum LKLayerPropertyID {
+	LAYER_POSITION,
+	LAYER_POSITION_OFFSET,
+	LAYER_ROTATION,
+	LAYER_SCALE,
+	LAYER_OPACITY
+};
+
+
+/** the running animations of built in layer properties, kept as arrays
+ *  of their components rather than as objects. A frame evaluates the
+ *  easing curves of every track from their tables, blends all the
+ *  values in one pass over the arrays, vectorised when LK_USE_SIMD is
+ *  defined, and then writes the results to the layers. Scalar
+ *  properties such as opacity use the x component only.
+ *
+ *  Tracks are owned by an LKAnimatable, whose m_track is kept equal to
+ *  the track's index as tracks are added and removed */
+class LKAnimationTracks {
+public:
+	/** adds a track moving property of layer from start to target over
+	 *  duration ticks from startTicks, following the LKEasing curve
+	 *  easing. Returns the track index */
+	int add(LKAnimatable* owner, LKLayer* layer, LKLayerPropertyID property,
+			const Coord3d& start, const Coord3d& target, int startTicks, int duration, int easing);
+	/** removes track, moving the last track into its place. Constant
+	 *  time */
+	void remove(int track);
+	/** changes the end points and start of track */
+	void retarget(int track, const Coord3d& start, const Coord3d& target, int startTicks);
+	void setEasing(int track, int easing);
+
+	/** evaluates every track at ticks and writes the values to the
+	 *  layers. The owners of tracks that have reached their target are
+	 *  appended to completed; they are left running for the caller to
+	 *  stop */
+	void evaluate(int ticks, std::vector<LKAnimatable*>& completed);
+
+	int size(void) const;
+	LKAnimatable* owner(int track) const;
+
+private:
+	/** computes m_valueX/Y/Z and m_isDone for every track */
+	void interpolate(double ticks);
+
+	// the tracks' parameters, indexed by track
+	std::vector<double> m_startX, m_startY, m_startZ;
+	std::vector<double> m_targetX, m_targetY, m_targetZ;
+	std::vector<double> m_startTicks;
+	std::vector<double> m_durations;
+	std::vector<int>           m_easing;
+	std::vector<unsigned char> m_properties;
+	std::vector<LKLayer*>      m_layers;
+	std::vector<LKAnimatable*> m_owners;
+
+	// the results of the last pass
+	std::vector<double> m_eased; /** the curve at each track's time */
+	std::vector<double> m_valueX, m_valueY, m_valueZ;
+	std::vector<unsigned char> m_isDone;
+};
+
+
+#endif
@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ */
+#include "LKEasing.h"
+
+#include <cmath>
+#include "platform/MathExtras.h"
+
+
+bool LKEasing::s_isExact = false;
+
+
+static double cubicIn(double t)
+{
+	return t * t * t;
+}
+
+static double quintIn(double t)
+{
+	return t * t * t * t * t;
+}
+
+/** the curve that mirrors f in the second half of the interval */
+static double inOut(double (*f)(double), double t)
+{
+	return t < 0.5 ? f(2 * t) / 2 : 1 - f(2 - 2 * t) / 2;
+}
+
+/** one coordinate of a cubic bezier from 0 to 1 with control values a
+ *  and b, at parameter s */
+static double bezier(double a, double b, double s)
+{
+	double r = 1 - s;
+	return 3 * r * r * s * a + 3 * r * s * s * b + s * s * s;
+}
+
+static double bezierSlope(double a, double b, double s)
+{
+	double r = 1 - s;
+	return 3 * r * r * a + 6 * r * s * (b - a) + 3 * s * s * (1 - b);
+}
+
+std::vector<LKEasing::Definition>& LKEasing::definitions(void)
+{
+	static std::vector<Definition> curves;
+	if (curves.empty()){
+		curves.reserve(BUILTIN_CURVES);
+		for (int i = 0; i < BUILTIN_CURVES; i++){
+			Definition d;
+			d.kind    = i == STEP ? KIND_STEPS : KIND_BUILTIN;
+			d.builtin = i;
+			d.x1 = d.y1 = d.x2 = d.y2 = 0;
+			d.steps   = 1;
+			curves.push_back(d);
+			fillTable(curves.back());
+		}
+	}
+	return curves;
+}
+
+int LKEasing::add(const Definition& d)
+{
+	std::vector<Definition>& curves = definitions();
+	curves.push_back(d);
+	fillTable(curves.back());
+	return static_cast<int>(curves.size()) - 1;
+}
+
+void LKEasing::fillTable(Definition& d)
+{
+	// linear and step curves are as cheap to evaluate as a table
+	if (d.kind == KIND_STEPS || (d.kind == KIND_BUILTIN && d.builtin == LINEAR))
+		return;
+	d.table.resize(TABLE_SEGMENTS + 1);
+	for (int i = 0; i <= TABLE_SEGMENTS; i++)
+		d.table[i] = static_cast<float>(evaluate(d, i / double(TABLE_SEGMENTS)));
+}
+
+int LKEasing::cubicBezier(double x1, double y1, double x2, double y2)
+{
+	x1 = std::min(std::max(x1, 0.0), 1.0);
+	x2 = std::min(std::max(x2, 0.0), 1.0);
+
+	std::vector<Definition>& curves = definitions();
+	for (size_t i = BUILTIN_CURVES; i < curves.size(); i++){
+		const Definition& d = curves[i];
+		if (d.kind == KIND_BEZIER && d.x1 == x1 && d.y1 == y1 && d.x2 == x2 && d.y2 == y2)
+			return static_cast<int>(i);
+	}
+
+	Definition d;
+	d.kind    = KIND_BEZIER;
+	d.builtin = -1;
+	d.x1      = x1;
+	d.y1      = y1;
+	d.x2      = x2;
+	d.y2      = y2;
+	d.steps   = 0;
+	return add(d);
+}
+
+int LKEasing::steps(int count)
+{
+	count = std::max(count, 1);
+	if (count == 1)
+		return STEP;
+
+	std::vector<Definition>& curves = definitions();
+	for (size_t i = BUILTIN_CURVES; i < curves.size(); i++)
+		if (curves[i].kind == KIND_STEPS && curves[i].steps == count)
+			return static_cast<int>(i);
+
+	Definition d;
+	d.kind    = KIND_STEPS;
+	d.builtin = -1;
+	d.x1 = d.y1 = d.x2 = d.y2 = 0;
+	d.steps   = count;
+	return add(d);
+}
+
+double LKEasing::evaluateExact(int curve, double t)
+{
+	// written so that NaN becomes 0
+	t = t > 0 ? std::min(t, 1.0) : 0;
+	return evaluate(definitions()[curve], t);
+}
+
+double LKEasing::evaluate(const Definition& d, double t)
+{
+	switch (d.kind){
+	case KIND_STEPS:
+		return std::floor(t * d.steps) / d.steps;
+
+	case KIND_BEZIER: {
+		// find the parameter whose x is t by Newton's method, falling back
+		// to bisection where the slope is too flat to follow
+		double s = t;
+		for (int i = 0; i < 8; i++){
+			double err   = bezier(d.x1, d.x2, s) - t;
+			double slope = bezierSlope(d.x1, d.x2, s);
+			if (std::fabs(err) < 1e-12)
+				return bezier(d.y1, d.y2, s);
+			if (std::fabs(slope) < 1e-6)
+				break;
+			s -= err / slope;
+			if (s < 0 || s > 1)
+				break;
+		}
+		double lo = 0;
+		double hi = 1;
+		s = t;
+		for (int i = 0; i < 64; i++){
+			double x = bezier(d.x1, d.x2, s);
+			if (std::fabs(x - t) < 1e-12)
+				break;
+			if (x < t)
+				lo = s;
+			else
+				hi = s;
+			s = (lo + hi) / 2;
+		}
+		return bezier(d.y1, d.y2, s);
+	}
+
+	case KIND_BUILTIN:
+		break;
+	}
+
+	switch (d.builtin){
+	case COSINE:       return (1 - std::cos(t * M_PI)) / 2;
+	case CUBIC_IN:     return cubicIn(t);
+	case CUBIC_OUT:    return 1 - cubicIn(1 - t);
+	case CUBIC_IN_OUT: return inOut(cubicIn, t);
+	case QUINT_IN:     return quintIn(t);
+	case QUINT_OUT:    return 1 - quintIn(1 - t);
+	case QUINT_IN_OUT: return inOut(quintIn, t);
+	default:           return t;
+	}
+}
+
+void LKEasing::setExact(bool exact)
+{
+	s_isExact = exact;
+}
+
+bool LKEasing::isExact(void)
+{
+	return s_isExact;
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ */
+#ifndef LKEasing_h
+#define LKEasing_h
+
+#include <algorithm>
+#include <vector>
+
+
+/** the easing curves animations follow, identified by small integers so
+ *  that they can be stored per animation. A curve maps the normalised
+ *  time of an animation, from 0 to 1, to the fraction of the way from
+ *  its start to its target.
+ *
+ *  Curves are evaluated from tables precomputed when the curve is first
+ *  registered, interpolating linearly between 1024 samples, so no
+ *  transcendental functions are called while animating. Step curves are
+ *  evaluated directly, as interpolation would blur their jumps. Exact
+ *  mode evaluates every curve from its definition instead, for tests
+ *  that compare against known values */
+class LKEasing {
+public:
+	/** the built in curves */
+	enum Curve {
+		LINEAR,
+		COSINE,       /** (1 - cos(pi t)) / 2, the default */
+		CUBIC_IN,
+		CUBIC_OUT,
+		CUBIC_IN_OUT,
+		QUINT_IN,
+		QUINT_OUT,
+		QUINT_IN_OUT,
+		STEP,         /** 0 until the end, then 1 */
+		BUILTIN_CURVES
+	};
+
+	/** returns the curve of the CSS style cubic bezier from (0, 0) to
+	 *  (1, 1) with control points (x1, y1) and (x2, y2). x1 and x2 are
+	 *  clamped to [0, 1]. Asking for the same points again returns the
+	 *  same curve */
+	static int cubicBezier(double x1, double y1, double x2, double y2);
+	/** returns the curve that rises to 1 in count equal steps, jumping at
+	 *  the end of each interval */
+	static int steps(int count);
+
+	/** the value of curve at t, which is clamped to [0, 1] */
+	static double evaluate(int curve, double t);
+	/** the value of curve at t computed from its definition */
+	static double evaluateExact(int curve, double t);
+
+	/** when set, evaluate() is exact rather than using the tables */
+	static void setExact(bool exact);
+	static bool isExact(void);
+
+	enum {TABLE_SEGMENTS = 1024};
+
+private:
+	enum Kind {KIND_BUILTIN, KIND_BEZIER, KIND_STEPS};
+
+	struct Definition {
+		Kind   kind;
+		int    builtin;
+		double x1, y1, x2, y2;
+		int    steps;
+		/** TABLE_SEGMENTS + 1 samples, or empty for curves evaluated
+		 *  directly */
+		std::vector<float> table;
+	};
+
+	static std::vector<Definition>& definitions(void);
+	static int add(const Definition& d);
+	static void fillTable(Definition& d);
+	static double evaluate(const Definition& d, double t);
+	static bool s_isExact;
+};
+
+
+inline double LKEasing::evaluate(int curve, double t)
+{
+	// written so that NaN becomes 0
+	t = t > 0 ? std::min(t, 1.0) : 0;
+	const Definition& d = definitions()[curve];
+	if (s_isExact || d.table.empty())
+		return evaluate(d, t);
+
+	double pos = t * TABLE_SEGMENTS;
+	int    i   = std::min(static_cast<int>(pos), TABLE_SEGMENTS - 1);
+	double f   = pos - i;
+	return d.table[i] + (d.table[i + 1] - d.table[i]) * f;
+}
+
+
+#endif
@@ -20,12 +20,16 @@
  */
 #include "LKEngine.h"
 
+#include <algorithm>
 #include <assert.h>
 #include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 #include <iostream>
+#include <iterator>
 #include <math.h>
 #include "LKAnimation.h"
+#include "LKEventRecording.h"
+#include "LKEventRing.h"
 #include "LKLayer.h"
 #include "LKUtil.h"
 #include "platform/gl.h"
@@ -36,13 +40,67 @@ using namespace std;
 #define foreach BOOST_FOREACH
 
 
+/** returns true if a is drawn after b, meaning that a comes later in a
+ *  depth first walk of the layer tree */
+static bool isDrawnAfter(const LKLayer* a, const LKLayer* b)
+{
+	int depthA = 0;
+	int depthB = 0;
+	for (const LKLayer* l = a->superlayer(); l != NULL; l = l->superlayer())
+		depthA++;
+	for (const LKLayer* l = b->superlayer(); l != NULL; l = l->superlayer())
+		depthB++;
+
+	// bring the deeper layer up to the depth of the other
+	const LKLayer* ia = a;
+	const LKLayer* ib = b;
+	for (; depthA > depthB; depthA--)
+		ia = ia->superlayer();
+	for (; depthB > depthA; depthB--)
+		ib = ib->superlayer();
+	if (ia == ib)
+		return a != ia; // one is an ancestor of the other, or they are the same
+
+	// walk up together to the children of the common ancestor
+	while (ia->superlayer() != ib->superlayer()){
+		ia = ia->superlayer();
+		ib = ib->superlayer();
+	}
+	return ia->indexInSuperlayer() > ib->indexInSuperlayer();
+}
+
+/** orders hits nearest the camera first, and topmost first at equal
+ *  depths */
+static bool isNearer(const LKHitRecord& a, const LKHitRecord& b)
+{
+	if (a.depth != b.depth)
+		return a.depth < b.depth;
+	return isDrawnAfter(a.layer, b.layer);
+}
+
+
 LKEngine::LKEngine(void)
     : m_yfov(90)
     , m_cameraPos(0, 0, 0)
     , m_root(new LKLayer())
 	, m_glIntersectLayers(0)
 	, m_animator(new LKLinearAnimator(NULL))
+	, m_renderMode(RENDER_RECURSIVE)
+	, m_removedLayers(0)
+	, m_keyDispatchDepth(0)
+	, m_hasKeyListenerRemovals(false)
+	, m_usesTransformStore(false)
+	, m_cullsLayers(false)
+	, m_inputRing(NULL)
+	, m_recorder(NULL)
+	, m_eventDispatchDepth(0)
 {
+	m_viewport[0] = m_viewport[1] = 0;
+	m_viewport[2] = m_viewport[3] = 1;
+	std::fill(m_lastQueuedEvent, m_lastQueuedEvent + N_MOUSE_DEVICES, -1);
+	resetPickStats();
+	updateProjection();
+	m_root->setEngine(this);
 	initViewportTexture();
 }
 
@@ -51,12 +109,28 @@ LKEngine::LKEngine(LKLayer* root)
     , m_cameraPos(0, 0, 0)
     , m_root(root)
 	, m_glIntersectLayers(0)
+	, m_renderMode(RENDER_RECURSIVE)
+	, m_removedLayers(0)
+	, m_keyDispatchDepth(0)
+	, m_hasKeyListenerRemovals(false)
+	, m_usesTransformStore(false)
+	, m_cullsLayers(false)
+	, m_inputRing(NULL)
+	, m_recorder(NULL)
+	, m_eventDispatchDepth(0)
 {
+	m_viewport[0] = m_viewport[1] = 0;
+	m_viewport[2] = m_viewport[3] = 1;
+	std::fill(m_lastQueuedEvent, m_lastQueuedEvent + N_MOUSE_DEVICES, -1);
+	resetPickStats();
+	updateProjection();
+	m_root->setEngine(this);
 	initViewportTexture();
 }
 
 LKEngine::~LKEngine(void)
 {
+	m_root->setEngine(NULL);
 }
 #define CHECK_FRAMEBUFFER_STATUS() \
 { \
@@ -98,17 +172,118 @@ void LKEngine::initViewportTexture(void)
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
 }
 	
+static LKEngine::TickFunction tickFunction = NULL;
+
 int LKEngine::getTicks(void)
 {
+	if (tickFunction != NULL)
+		return tickFunction();
 	const static int mult = 1000 / CLOCKS_PER_SEC;
 	return static_cast<int>(clock() * mult);
 }
 
+void LKEngine::setTickFunction(TickFunction f)
+{
+	tickFunction = f;
+}
+
 LKLayer* LKEngine::root(void) const
 {
     return m_root;
 }
 
+LKLayer* LKEngine::layerWithTag(const int tag) const
+{
+	return m_layerTable.layerWithTag(tag);
+}
+
+LKLayer* LKEngine::layerForHandle(const LKLayerHandle& handle) const
+{
+	return m_layerTable.layer(handle);
+}
+
+int LKEngine::layerCount(void) const
+{
+	return m_layerTable.size();
+}
+
+bool LKEngine::usesTransformStore(void) const
+{
+	return m_usesTransformStore;
+}
+
+void LKEngine::setUsesTransformStore(bool v)
+{
+	if (m_usesTransformStore == v)
+		return;
+	m_usesTransformStore = v;
+	if (v)
+		m_transformStore.reserveSlots(m_layerTable.capacity());
+	for (int i = 0; i < m_layerTable.capacity(); i++){
+		LKLayer* layer = m_layerTable.layerAtIndex(i);
+		if (layer != NULL)
+			layer->setTransformStore(v ? &m_transformStore : NULL);
+	}
+}
+
+LKTransformStore& LKEngine::transformStore(void)
+{
+	return m_transformStore;
+}
+
+void LKEngine::transformStoreDidChange(int firstSlot, int count)
+{
+	for (int i = firstSlot; i < firstSlot + count; i++){
+		LKLayer* layer = m_layerTable.layerAtIndex(i);
+		if (layer != NULL)
+			layer->invalidateTransform();
+	}
+}
+
+void LKEngine::registerLayer(LKLayer* layer)
+{
+	layer->m_handle = m_layerTable.insert(layer);
+	if (m_usesTransformStore)
+		layer->setTransformStore(&m_transformStore);
+
+	if (m_pickLeaves.size() < size_t(m_layerTable.capacity())){
+		m_pickLeaves.resize(m_layerTable.capacity(), -1);
+		m_pickRegions.resize(m_layerTable.capacity());
+	}
+	m_pickRegions[layer->m_handle.index] = pickRegion(layer);
+	m_pickLeaves[layer->m_handle.index]  = m_pickTree.insert(layer, m_pickRegions[layer->m_handle.index].box());
+	layer->m_dirtyFlags &= ~LKLayer::PICK_BOUNDS_DIRTY;
+
+	if (layer->m_wantsKeyEvents)
+		addKeyListener(layer);
+	if (layer->m_animator != NULL)
+		layer->m_animator->setScheduler(&m_animationScheduler);
+}
+
+void LKEngine::unregisterLayer(LKLayer* layer)
+{
+	layer->setTransformStore(NULL);
+	if (layer->m_wantsKeyEvents)
+		removeKeyListener(layer);
+	if (layer->m_animator != NULL)
+		layer->m_animator->setScheduler(NULL);
+	m_pickTree.remove(m_pickLeaves[layer->m_handle.index]);
+	m_pickLeaves[layer->m_handle.index] = -1;
+	m_layerTable.remove(layer->m_handle);
+	layer->m_handle = LKLayerHandle();
+	m_removedLayers++;
+}
+
+LKEngine::RenderMode LKEngine::renderMode(void) const
+{
+	return m_renderMode;
+}
+
+void LKEngine::setRenderMode(RenderMode mode)
+{
+	m_renderMode = mode;
+}
+
 const double LKEngine::FOV(void) const
 {
 	return m_yfov;
@@ -116,27 +291,68 @@ const double LKEngine::FOV(void) const
 
 void LKEngine::setFOV(double fov)
 {
-	GLint viewport[4];
-	glGetIntegerv(GL_VIEWPORT, viewport);
-	GLfloat ratio = (GLfloat)(viewport[2] / (GLfloat)viewport[3]);
 	m_yfov = fov;
+	updateProjection();
        
 	glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-	gluPerspective(m_yfov, ratio, 0.1f, 100.0f);
+    glLoadMatrixd(m_projection.m);
 	glMatrixMode(GL_MODELVIEW);
 }
 
+const Matrix4d& LKEngine::projectionMatrix(void) const
+{
+	return m_projection;
+}
+
+const Matrix4d& LKEngine::viewMatrix(void) const
+{
+	return m_view;
+}
+
+const int* LKEngine::viewport(void) const
+{
+	return m_viewport;
+}
+
+const Frustumd& LKEngine::frustum(void) const
+{
+	return m_frustum;
+}
+
+LKAnimationScheduler& LKEngine::animationScheduler(void)
+{
+	return m_animationScheduler;
+}
+
+bool LKEngine::cullsLayers(void) const
+{
+	return m_cullsLayers;
+}
+
+void LKEngine::setCullsLayers(bool v)
+{
+	m_cullsLayers = v;
+}
+
+void LKEngine::updateProjection(void)
+{
+	double ratio = m_viewport[2] / double(m_viewport[3]);
+	m_projection = Matrix4d::perspective(m_yfov, ratio, 0.1, 100.0);
+}
+
 void LKEngine::windowDidResize(int width, int height)
 {
     if (height == 0)
     	height = 1;
-    GLfloat ratio = (GLfloat)(width / (GLfloat)height);
+    m_viewport[0] = 0;
+    m_viewport[1] = 0;
+    m_viewport[2] = width;
+    m_viewport[3] = height;
+    updateProjection();
     glViewport(0, 0, (GLsizei)width, (GLsizei)height);
     
     glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(m_yfov, ratio, 0.1f, 100.0f);
+    glLoadMatrixd(m_projection.m);
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
 	
@@ -168,55 +384,130 @@ void LKEngine::callDisplay(void)
 	render();
 }
 
+void LKEngine::update(void)
+{
+	processLKEvents();
+	m_animationScheduler.tick(LKEngine::getTicks());
+}
+
 void LKEngine::render(void)
+{
+	update();
+	drawLayerTree();
+}
+
+void LKEngine::drawLayerTree(void)
 {
 	static int lastTick = 0;
 	int currTick = LKEngine::getTicks();
     int ticksPast = currTick - lastTick;
     lastTick = currTick;
 
-	// render the layer tree
 	glClearColor(0.75, 0.75, 0.75, 1.0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
     
+	m_view    = Matrix4d::translation(-m_cameraPos.x, -m_cameraPos.y, -m_cameraPos.z);
+	m_frustum = Frustumd(m_projection * m_view);
 	glMatrixMode(GL_MODELVIEW);
 	glLoadIdentity();
     
 	glPushMatrix();
-	glTranslated(-m_cameraPos.x, -m_cameraPos.y, -m_cameraPos.z);
+	glLoadMatrixd(m_view.m);
     
 	// render the non transparent layers first, and then the transparent layers
 	glPushAttrib(GL_DEPTH_BUFFER_BIT);
 	glDepthMask(true);
 	glEnable(GL_DEPTH_TEST);
-	m_root->display(ticksPast);
-	glDepthMask(false);
-	m_root->display(ticksPast, LKLayer::DRAW_TRANSPARENT);
-	m_root->display(ticksPast, LKLayer::POST_DRAW);
+	if (m_renderMode == RENDER_DRAW_LISTS){
+		m_opaqueList.clear();
+		m_transparentList.clear();
+		m_postDrawList.clear();
+		buildDrawLists(m_root, ticksPast);
+
+		drawDrawList(m_opaqueList, false);
+		glDepthMask(false);
+		drawDrawList(m_transparentList, false);
+		drawDrawList(m_postDrawList, true);
+	} else {
+		m_root->display(ticksPast);
+		glDepthMask(false);
+		m_root->display(ticksPast, LKLayer::DRAW_TRANSPARENT);
+		m_root->display(ticksPast, LKLayer::POST_DRAW);
+	}
 	glDepthMask(true);
 	glPopAttrib();
 
 	glPopMatrix();
 }
 
+void LKEngine::buildDrawLists(LKLayer* layer, long millisecondsPast)
+{
+	if (layer->isCulled())
+		return;
+
+	LKDrawItem item = {layer, layer->worldContentTransform()};
+	if (layer->position().z <= 0){
+		if (layer->opacity() == 1.0)
+			m_opaqueList.push_back(item);
+		else
+			m_transparentList.push_back(item);
+	}
+	m_postDrawList.push_back(item);
+
+	foreach (LKLayer* l, layer->m_layers){
+		if (l->isHidden())
+			continue;
+		buildDrawLists(l, millisecondsPast);
+	}
+}
+
+void LKEngine::drawDrawList(const LKDrawList& list, bool postDraw)
+{
+	foreach (const LKDrawItem& item, list){
+		glPushMatrix();
+		glMultMatrixd(item.transform.m);
+		glLoadName(item.layer->tag());
+		if (postDraw)
+			item.layer->postDraw();
+		else
+			item.layer->draw();
+		glPopMatrix();
+	}
+
+	// the debug outlines are drawn in the frame of each superlayer
+	if (postDraw && LKLayer::debugLayer()){
+		foreach (const LKDrawItem& item, list){
+			glPushMatrix();
+			if (item.layer->superlayer() != NULL)
+				glMultMatrixd(item.layer->superlayer()->worldTransform().m);
+			item.layer->drawDebugBounds();
+			glPopMatrix();
+		}
+	}
+}
+
 GLuint LKEngine::renderToTexture(void)
 {
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, m_frameBuffer);
 
+	// render with the texture's projection so that layers are culled
+	// against the right view volume
+	Matrix4d projection = m_projection;
+	m_projection = Matrix4d::perspective(m_yfov, 1280.0 / 960.0, 0.1, 100.0);
+
 	glMatrixMode( GL_PROJECTION );
 	glPushMatrix();
-	glLoadIdentity();
-	
-	gluPerspective(m_yfov, 1280.0f / 960.0f, 0.1f, 100.0f);
+	glLoadMatrixd(m_projection.m);
 
 	glMatrixMode( GL_MODELVIEW );
 
 	glPushAttrib(GL_VIEWPORT_BIT);
 	glViewport(0, 0, 512, 512);
-	render();
+	drawLayerTree();
 	glPopAttrib();
 	glMatrixMode( GL_PROJECTION );
 	glPopMatrix();
+	m_projection = projection;
 	
 	glMatrixMode( GL_MODELVIEW );
 	
@@ -268,27 +559,171 @@ vector<LKLayer*> LKEngine::hitTest(Coord2d& p)
 			//result.push_back(m_root->sublayers()[hitTag]);
         }
     }
-*/	std::vector<LKLayer*> result(0);
-    // find the 2D layer intersections
-	std::stack<LKLayer*> layerStack;
-	result.push_back(m_root);
-	layerStack.push(m_root);
-
-	// to do this, recursively iterate through all the layers
-	// converting the point on the screen to a point on the
-	// same plane as the layer.
-	while (!layerStack.empty()){
-		LKLayer* layer = layerStack.top();
-		layerStack.pop();
-		Coord2d c = convertPointToLayer(p, layer);
-		if (layer->mouseInRect(c, layer->bounds()))
-            result.push_back(layer);
-		foreach (LKLayer* subLayer, layer->sublayers())
-			layerStack.push(subLayer);
-	}
+*/	LKHitList hits;
+	pick(p, hits);
+
+	std::vector<LKLayer*> result(0);
+	result.reserve(hits.size());
+	foreach (const LKHitRecord& hit, hits)
+		result.push_back(hit.layer);
     return result;
 }
 
+LKRay LKEngine::rayThroughPoint(const Coord2d& p) const
+{
+	// the ray is in the frame convertPointToLayer has always used: eye
+	// coordinates moved along z by the camera
+	LKRay ray;
+	ray.origin = Coord3d(0, 0, m_cameraPos.z);
+
+	Matrix4d inverse;
+	if (!m_projection.inverse(inverse)){
+		ray.direction = Coord3d(0, 0, -1);
+		return ray;
+	}
+	Coord3d farPoint;
+	unprojectPoint(Coord3d(p.x, m_viewport[3] - p.y, 1), inverse, m_viewport, farPoint);
+	ray.direction = farPoint.normalise();
+	return ray;
+}
+
+void LKEngine::pick(const Coord2d& p, LKHitList& hits)
+{
+	updatePickTree();
+
+	const LKRay ray = rayThroughPoint(p);
+	m_pickCandidates.clear();
+	m_pickTree.raycast(ray.origin, ray.direction, m_pickCandidates);
+	resolvePick(ray, m_pickCandidates, hits);
+
+	m_pickStats.rays++;
+	m_pickStats.candidates += static_cast<int>(m_pickCandidates.size());
+	m_pickStats.hits       += static_cast<int>(hits.size());
+}
+
+void LKEngine::pick(const vector<Coord2d>& points, vector<LKHitList>& hits)
+{
+	updatePickTree();
+
+	const int n = static_cast<int>(points.size());
+	hits.resize(n);
+	if (n == 0)
+		return;
+
+	vector<Coord3d> origins(n);
+	vector<Coord3d> directions(n);
+	m_pickRays.resize(n);
+	m_batchCandidates.resize(n);
+	for (int i = 0; i < n; i++){
+		m_pickRays[i] = rayThroughPoint(points[i]);
+		origins[i]    = m_pickRays[i].origin;
+		directions[i] = m_pickRays[i].direction;
+		m_batchCandidates[i].clear();
+	}
+
+	m_pickTree.raycast(&origins[0], &directions[0], n, &m_batchCandidates[0]);
+	for (int i = 0; i < n; i++){
+		resolvePick(m_pickRays[i], m_batchCandidates[i], hits[i]);
+		m_pickStats.candidates += static_cast<int>(m_batchCandidates[i].size());
+		m_pickStats.hits       += static_cast<int>(hits[i].size());
+	}
+	m_pickStats.rays += n;
+}
+
+const LKPickStats& LKEngine::pickStats(void) const
+{
+	return m_pickStats;
+}
+
+void LKEngine::resetPickStats(void)
+{
+	m_pickStats.rays       = 0;
+	m_pickStats.candidates = 0;
+	m_pickStats.hits       = 0;
+}
+
+void LKEngine::resolvePick(const LKRay& ray, const vector<LKLayer*>& candidates, LKHitList& hits) const
+{
+	hits.clear();
+
+	// the root always receives events, wherever they are
+	LKHitRecord rootHit;
+	intersectPickRegion(ray, m_root, rootHit);
+	hits.push_back(rootHit);
+
+	// the tree only narrows down the layers to test, so each candidate is
+	// then tested exactly against its region
+	foreach (LKLayer* layer, candidates){
+		if (layer == m_root)
+			continue;
+		LKHitRecord hit;
+		if (intersectPickRegion(ray, layer, hit) && hit.depth >= 0
+			&& layer->mouseInRect(hit.localPoint, m_pickRegions[layer->m_handle.index].rect))
+			hits.push_back(hit);
+	}
+
+	std::sort(hits.begin() + 1, hits.end(), isNearer);
+}
+
+bool LKEngine::intersectPickRegion(const LKRay& ray, LKLayer* layer, LKHitRecord& hit) const
+{
+	// registered layers use the region cached by the last refit
+	PickRegion region;
+	if (layer->m_engine == this && !(layer->m_dirtyFlags & LKLayer::PICK_BOUNDS_DIRTY))
+		region = m_pickRegions[layer->m_handle.index];
+	else
+		region = pickRegion(layer);
+
+	hit.layer = layer;
+	if (fabs(ray.direction.z) < 1e-12){
+		hit.localPoint = Coord2d(0, 0);
+		hit.depth      = -1;
+		return false;
+	}
+
+	double  t = (region.origin.z - ray.origin.z) / ray.direction.z;
+	Coord3d c = ray.origin + ray.direction * t;
+	hit.localPoint = Coord2d(c.x - region.origin.x, c.y - region.origin.y);
+	hit.depth      = t;
+	return true;
+}
+
+void LKEngine::layerPickBoundsDidChange(LKLayer* layer)
+{
+	m_pickRefitQueue.push_back(layer->m_handle);
+}
+
+void LKEngine::updatePickTree(void)
+{
+	foreach (const LKLayerHandle& handle, m_pickRefitQueue){
+		// layers removed since they were queued have stale handles
+		LKLayer* layer = m_layerTable.layer(handle);
+		if (layer == NULL || !(layer->m_dirtyFlags & LKLayer::PICK_BOUNDS_DIRTY))
+			continue;
+		m_pickRegions[handle.index] = pickRegion(layer);
+		m_pickTree.update(m_pickLeaves[handle.index], m_pickRegions[handle.index].box());
+		layer->m_dirtyFlags &= ~LKLayer::PICK_BOUNDS_DIRTY;
+	}
+	m_pickRefitQueue.clear();
+}
+
+LKEngine::PickRegion LKEngine::pickRegion(LKLayer* layer) const
+{
+	PickRegion region;
+	region.origin = Coord3d(0, 0, 0);
+	layer->convertFromVWorld(region.origin);
+	region.rect = layer->bounds();
+	return region;
+}
+
+Box3d LKEngine::PickRegion::box(void) const
+{
+	if (rect.t > rect.v || rect.u > rect.w)
+		return Box3d(origin, origin);
+	return Box3d(Coord3d(origin.x + rect.t, origin.y + rect.u, origin.z),
+				 Coord3d(origin.x + rect.v, origin.y + rect.w, origin.z));
+}
+
 Coord2d LKEngine::convertPointToLayer(Coord2d& aPoint, LKLayer* aView)
 {/*
     GLint viewport[4];
@@ -305,29 +740,9 @@ Coord2d LKEngine::convertPointToLayer(Coord2d& aPoint, LKLayer* aView)
               y * tan(m_yfov / 2.0) * (m_cameraPos.z - offset.z) * (viewport[3] / (double)viewport[2]) - offset.y);
 
 	return c;*/
-	Coord3d offset(0,0,0);
-	aView->convertFromVWorld(offset);
-
-	GLint viewport[4];
-	GLdouble modelview[16];
-	GLdouble projection[16];
-	GLfloat winX, winY, winZ;
-	GLdouble posX, posY, posZ;
-
-	glGetDoublev( GL_MODELVIEW_MATRIX, modelview );
-	glGetDoublev( GL_PROJECTION_MATRIX, projection );
-	glGetIntegerv( GL_VIEWPORT, viewport );
-
-	GLdouble wx, wy, wz;
-	gluProject(0, 0, offset.z - m_cameraPos.z, modelview, projection, viewport, &wx, &wy, &wz);
-
-	winX = (float)(aPoint.x);
-	winY = (float)viewport[3] - (float)aPoint.y;
-	winZ = wz;
-		
-	int i = gluUnProject(winX, winY, winZ, modelview, projection, viewport, &posX, &posY, &posZ);
-
-	return Coord2d(posX - offset.x, posY - offset.y);
+	LKHitRecord hit;
+	intersectPickRegion(rayThroughPoint(aPoint), aView, hit);
+	return hit.localPoint;
 }
 
 bool LKEngine::mouseIsInGLLayerContents(LKLayer* layer)
@@ -338,86 +753,322 @@ bool LKEngine::mouseIsInGLLayerContents(LKLayer* layer)
     return false;
 }
 
-void LKEngine::handleLKEvent(LKEvent* srcEvent)
+LKLayer* LKEngine::firstResponder(void) const
 {
-    typedef list<LKLayer*>::iterator LKLayerListItr;
+	return m_layerTable.layer(m_firstResponder);
+}
 
-    LKEvent evt = *srcEvent;
+void LKEngine::setFirstResponder(LKLayer* layer)
+{
+	if (layer != NULL && layer->m_engine == this)
+		m_firstResponder = layer->m_handle;
+	else
+		m_firstResponder = LKLayerHandle();
+}
 
-	if ((srcEvent->type & DEV_KEY) != 0){
-		std::stack<LKLayer*> layerStack;
-		layerStack.push(m_root);
-		while (!layerStack.empty()){
-			LKLayer* layer = layerStack.top();
-			layerStack.pop();
-			layer->keydown(srcEvent);
-			foreach (LKLayer* subLayer, layer->sublayers())
-				layerStack.push(subLayer);
+void LKEngine::addKeyListener(LKLayer* layer)
+{
+	int index = layer->m_handle.index;
+	if (m_keyListenerIndices.size() <= size_t(index))
+		m_keyListenerIndices.resize(m_layerTable.capacity(), -1);
+	m_keyListenerIndices[index] = static_cast<int>(m_keyListeners.size());
+	m_keyListeners.push_back(layer->m_handle);
+}
+
+void LKEngine::removeKeyListener(LKLayer* layer)
+{
+	int index = layer->m_handle.index;
+	int i     = m_keyListenerIndices[index];
+	if (m_keyDispatchDepth > 0){
+		// moving listeners now would make the dispatch skip or repeat them
+		m_keyListeners[i]           = LKLayerHandle();
+		m_keyListenerIndices[index] = -1;
+		m_hasKeyListenerRemovals    = true;
+		return;
+	}
+
+	// swap the last listener into the place of the one removed
+	m_keyListeners[i] = m_keyListeners.back();
+	m_keyListenerIndices[m_keyListeners[i].index] = i;
+	m_keyListeners.pop_back();
+	m_keyListenerIndices[index] = -1;
+}
+
+void LKEngine::compactKeyListeners(void)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < m_keyListeners.size(); i++){
+		if (m_keyListeners[i].isNull())
+			continue;
+		m_keyListeners[n] = m_keyListeners[i];
+		m_keyListenerIndices[m_keyListeners[n].index] = static_cast<int>(n);
+		n++;
+	}
+	m_keyListeners.resize(n);
+	m_hasKeyListenerRemovals = false;
+}
+
+void LKEngine::handleKeyEvent(LKEvent* evt)
+{
+	// taken for the length of the call, as handlers may handle key
+	// events of their own
+	vector<LKLayerHandle> visited;
+	visited.swap(m_keyVisited);
+	visited.clear();
+
+	bool isConsumed = false;
+	for (LKLayer* layer = firstResponder(); layer != NULL && !isConsumed; layer = layer->superlayer()){
+		if (layer->m_wantsKeyEvents)
+			visited.push_back(layer->m_handle);
+		isConsumed = !layer->keydown(evt);
+	}
+
+	// listeners added by the handlers are appended, and are not sent
+	// this event
+	m_keyDispatchDepth++;
+	const size_t count = m_keyListeners.size();
+	for (size_t i = 0; i < count && !isConsumed; i++){
+		const LKLayerHandle handle = m_keyListeners[i];
+		if (std::find(visited.begin(), visited.end(), handle) != visited.end())
+			continue;
+		LKLayer* layer = m_layerTable.layer(handle);
+		if (layer != NULL)
+			isConsumed = !layer->keydown(evt);
+	}
+	m_keyDispatchDepth--;
+	if (m_keyDispatchDepth == 0 && m_hasKeyListenerRemovals)
+		compactKeyListeners();
+
+	m_keyVisited.swap(visited);
+}
+
+/** returns true if events of type only report where a device is */
+static bool isCoalescable(int type)
+{
+	const int motionTypes = DEV_MOTION | DEV_LEFT_BUTTON_DRAGGED | DEV_RIGHT_BUTTON_DRAGGED;
+	return (type & (DEV_MOTION | DEV_BUTTON_DRAGGED)) != 0 && (type & ~motionTypes) == 0;
+}
+
+void LKEngine::postLKEvent(const LKEvent* evt)
+{
+	if (m_recorder != NULL && m_eventDispatchDepth == 0)
+		m_recorder->record(LKEventRecord::POSTED, evt);
+
+	int dev = evt->deviceID;
+	bool isTracked = dev >= 0 && dev < N_MOUSE_DEVICES;
+
+	if (isTracked && isCoalescable(evt->type) && m_lastQueuedEvent[dev] >= 0){
+		LKEvent& last = m_eventQueue[m_lastQueuedEvent[dev]];
+		if (last.type == evt->type && last.buttonID == evt->buttonID){
+			last.screenLocation  = evt->screenLocation;
+			last.relativeMotion += evt->relativeMotion;
+			return;
 		}
 	}
 
+	m_eventQueue.push_back(*evt);
+	if (isTracked)
+		m_lastQueuedEvent[dev] = static_cast<int>(m_eventQueue.size()) - 1;
+}
+
+void LKEngine::setInputRing(LKEventRing* ring)
+{
+	m_inputRing = ring;
+}
+
+LKEventRing* LKEngine::inputRing(void) const
+{
+	return m_inputRing;
+}
+
+void LKEngine::setEventRecorder(LKEventRecorder* recorder)
+{
+	m_recorder = recorder;
+}
+
+LKEventRecorder* LKEngine::eventRecorder(void) const
+{
+	return m_recorder;
+}
+
+void LKEngine::processLKEvents(void)
+{
+	// take everything the input thread has delivered since the last
+	// frame, so it is coalesced with the events posted directly
+	if (m_inputRing != NULL){
+		LKEvent evt;
+		while (m_inputRing->pop(evt))
+			postLKEvent(&evt);
+	}
+
+	// events posted by the handlers are left for the next frame
+	m_processingEvents.swap(m_eventQueue);
+	if (m_recorder != NULL)
+		m_recorder->record(LKEventRecord::FRAME, NULL);
+	std::fill(m_lastQueuedEvent, m_lastQueuedEvent + N_MOUSE_DEVICES, -1);
+
+	// consecutive motion events are resolved together. Any other event
+	// may change the scene, so it ends the run and is picked on its own
+	size_t i = 0;
+	m_eventDispatchDepth++;
+	while (i < m_processingEvents.size()){
+		if (isCoalescable(m_processingEvents[i].type))
+			i = handleMotionRun(i);
+		else
+			dispatchLKEvent(&m_processingEvents[i++]);
+	}
+	m_eventDispatchDepth--;
+	m_processingEvents.clear();
+}
+
+size_t LKEngine::handleMotionRun(size_t begin)
+{
+	size_t end = begin;
+	m_batchPoints.clear();
+	while (end < m_processingEvents.size() && isCoalescable(m_processingEvents[end].type))
+		m_batchPoints.push_back(m_processingEvents[end++].screenLocation);
+	pick(m_batchPoints, m_batchHits);
+
+	// the hits of the rest of the run are stale once a handler has
+	// removed a layer, so the rest is picked again
+	const unsigned removedLayers = m_removedLayers;
+	for (size_t i = begin; i < end; i++){
+		handleMotionEvent(&m_processingEvents[i], m_batchHits[i - begin]);
+		if (m_removedLayers != removedLayers)
+			return i + 1;
+	}
+	return end;
+}
+
+void LKEngine::handleMotionEvent(const LKEvent* srcEvent, const LKHitList& hits)
+{
+	// the hovered layers are only tracked for the first N_MOUSE_DEVICES
+	if (srcEvent->deviceID < 0 || srcEvent->deviceID >= N_MOUSE_DEVICES)
+		return;
+
+	LKEvent evt = *srcEvent;
+	Coord2d screenLocation = srcEvent->screenLocation;
+
+	// the handlers may handle events of their own, so the scratch
+	// buffers are taken for the length of the call, and the hovered set
+	// is diffed against as it was on entry
+	vector<LKLayerHandle> hitHandles;
+	vector<LKLayerHandle> hovered;
+	vector<LKLayerHandle> entered;
+	vector<LKLayerHandle> stillHovered;
+	hitHandles.swap(m_hitHandles);
+	hovered.swap(m_wasHovered);
+	entered.swap(m_entered);
+	stillHovered.swap(m_stillHovered);
+	hovered = m_hovered[srcEvent->deviceID];
+
+	// the layers hit, sorted for diffing against the hovered set
+	hitHandles.clear();
+	foreach (const LKHitRecord& hit, hits)
+		hitHandles.push_back(hit.layer->handle());
+	std::sort(hitHandles.begin(), hitHandles.end());
+
+	// handle mouse entered, moved and dragged events
+	entered.clear();
+    foreach (const LKHitRecord& hit, hits){
+		LKLayer* layer = hit.layer;
+		evt = *srcEvent;                
+		evt.devLocation = hit.localPoint;
+
+		// test if the mouse has not already been observed within
+		// this layer. If not, call the mouseEntered event
+		if (!std::binary_search(hovered.begin(), hovered.end(), layer->handle())){
+			entered.push_back(layer->handle());
+			if (!layer->mouseEntered(&evt))
+				break;
+        } else {
+            if ((srcEvent->type & DEV_MOTION) != 0)
+               layer->mouseMoved(&evt);
+			if ((srcEvent->type & DEV_BUTTON_DRAGGED) != 0)
+				layer->mouseDragged(&evt);
+        }
+    }// end foreach hitTarget
+
+    // handle mouse exited events. Walk the hovered set and the layers
+	// hit together; hovered layers that were not hit have been exited
+	stillHovered.clear();
+	vector<LKLayerHandle>::const_iterator h = hitHandles.begin();
+	foreach (const LKLayerHandle& handle, hovered){
+		while (h != hitHandles.end() && *h < handle)
+			++h;
+		if (h != hitHandles.end() && *h == handle){
+			stillHovered.push_back(handle);
+			continue;
+		}
+		// layers removed from the engine while hovered are dropped
+		LKLayer* layer = m_layerTable.layer(handle);
+		if (layer != NULL){
+			evt.devLocation = convertPointToLayer(screenLocation, layer);
+			layer->mouseExited(&evt);
+		}
+	}
+
+	std::sort(entered.begin(), entered.end());
+	vector<LKLayerHandle>& nowHovered = m_hovered[srcEvent->deviceID];
+	nowHovered.clear();
+	std::merge(stillHovered.begin(), stillHovered.end(),
+			   entered.begin(), entered.end(), std::back_inserter(nowHovered));
+
+	m_hitHandles.swap(hitHandles);
+	m_wasHovered.swap(hovered);
+	m_entered.swap(entered);
+	m_stillHovered.swap(stillHovered);
+}
+
+void LKEngine::handleLKEvent(LKEvent* evt)
+{
+	if (m_recorder != NULL && m_eventDispatchDepth == 0)
+		m_recorder->record(LKEventRecord::HANDLED, evt);
+	m_eventDispatchDepth++;
+	dispatchLKEvent(evt);
+	m_eventDispatchDepth--;
+}
+
+void LKEngine::dispatchLKEvent(LKEvent* srcEvent)
+{
+    typedef list<LKLayer*>::iterator LKLayerListItr;
+
+    LKEvent evt = *srcEvent;
+	// taken for the length of the call, as handlers may handle events
+	// of their own
+	LKHitList hits;
+	hits.swap(m_hits);
+
+	if ((srcEvent->type & DEV_KEY) != 0)
+		handleKeyEvent(srcEvent);
+
 	if ((srcEvent->type & DEV_SCROLL_Y) != 0){
-		foreach (LKLayer* layer, hitTest(srcEvent->screenLocation)){
-            evt.devLocation = convertPointToLayer(srcEvent->screenLocation, layer);     
-			layer->scrollWheel(&evt);
+		pick(srcEvent->screenLocation, hits);
+		foreach (const LKHitRecord& hit, hits){
+            evt.devLocation = hit.localPoint;
+			hit.layer->scrollWheel(&evt);
 		}
 	}
 	// button down
     else if ((srcEvent->type & DEV_BUTTON_DOWN) != 0){
-        foreach (LKLayer* layer, hitTest(srcEvent->screenLocation)){ 
-            evt.devLocation = convertPointToLayer(srcEvent->screenLocation, layer);     
-            layer->mouseDown(&evt);
+		pick(srcEvent->screenLocation, hits);
+        foreach (const LKHitRecord& hit, hits){
+            evt.devLocation = hit.localPoint;
+            hit.layer->mouseDown(&evt);
         } 
     // button up
     } else if ((srcEvent->type & DEV_BUTTON_UP) != 0){
-        foreach (LKLayer* layer, hitTest(srcEvent->screenLocation)){
-            evt.devLocation = convertPointToLayer(srcEvent->screenLocation, layer); 
-            if (!layer->mouseUp(&evt))
+		pick(srcEvent->screenLocation, hits);
+        foreach (const LKHitRecord& hit, hits){
+            evt.devLocation = hit.localPoint;
+            if (!hit.layer->mouseUp(&evt))
 				break;
         }
     // dev motion and dev dragged events
     } else if ((srcEvent->type & DEV_MOTION) != 0 || (srcEvent->type & DEV_BUTTON_DRAGGED) != 0){
 		
-		LKLayerList* layersMouseIn  = &m_layersMouseIn[srcEvent->deviceID];
-        vector<LKLayer*> hitTargets = hitTest(srcEvent->screenLocation);   
-
-		// handle mouse entered, moved and dragged events
-        foreach (LKLayer* layer, vector<LKLayer*>(hitTargets)){    
-			evt = *srcEvent;                
-			evt.devLocation = convertPointToLayer(srcEvent->screenLocation, layer); 
-
-			// test if the mouse has not already been observed within
-			// this layer. If not, call the mouseEntered event
-			if (!contains(*layersMouseIn, layer)){
-				layersMouseIn->push_back(layer);
-				if (!layer->mouseEntered(&evt))
-					break;
-            } else {
-                if ((srcEvent->type & DEV_MOTION) != 0)
-                   layer->mouseMoved(&evt);
-				if ((srcEvent->type & DEV_BUTTON_DRAGGED) != 0)
-					layer->mouseDragged(&evt);
-            }
-        }// end foreach hitTarget
-
-        // handle mouse exited events. find all the layers the mouse 
-		// was previously observed in but is no longer in and call 
-		// the mouse exited handler				
-		if (!layersMouseIn->empty()){
-			LKLayerList adjustedList;
-			bool isModified = false;
-			foreach (LKLayer* layer, *layersMouseIn){
-				if (!contains(hitTargets, layer)){
-					evt.devLocation = convertPointToLayer(srcEvent->screenLocation, layer);
-					layer->mouseExited(&evt);
-					isModified = true;
-				} else {
-					// else the mouse is still in the layer and must be remembered 
-					adjustedList.push_back(layer);
-				}
-			}
-			if (isModified)
-				*layersMouseIn = adjustedList;
-		}
+		pick(srcEvent->screenLocation, hits);
+		handleMotionEvent(srcEvent, hits);
 	}// end if
+	m_hits.swap(hits);
 }
\ No newline at end of file
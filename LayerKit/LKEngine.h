@@ -25,6 +25,12 @@
 #include <list>
 #include <vector>
 #include "math/Coord.h"
+#include "math/Frustum.h"
+#include "math/Matrix4.h"
+#include "LKAnimationScheduler.h"
+#include "LKLayerBVH.h"
+#include "LKLayerTable.h"
+#include "LKTransformStore.h"
 using std::vector;
 
 
@@ -32,10 +38,47 @@ using std::vector;
 #define N_MOUSE_DEVICES 24
 
 class  LKAnimator;
+class  LKEventRecorder;
+class  LKEventRing;
 class  LKLayer;
 struct LKEvent;
 struct TextureImage;
 
+
+/** a layer queued for drawing, along with the world transform its
+ *  contents are drawn with */
+struct LKDrawItem {
+	LKLayer* layer;
+	Matrix4d transform;
+};
+
+typedef std::vector<LKDrawItem> LKDrawList;
+
+
+/** a ray in the coordinate system of the root layer. direction is of
+ *  unit length */
+struct LKRay {
+	Coord3d origin;
+	Coord3d direction;
+};
+
+/** a layer found under a screen point */
+struct LKHitRecord {
+	LKLayer* layer;
+	Coord2d  localPoint; /** the point in the layer's coordinates */
+	double   depth;      /** the distance from the camera to the point */
+};
+
+typedef std::vector<LKHitRecord> LKHitList;
+
+/** counts of the work done picking layers, for measuring dispatch */
+struct LKPickStats {
+	int rays;       /** rays cast into the pick tree */
+	int candidates; /** layers whose boxes the rays crossed */
+	int hits;       /** layers the rays hit */
+};
+
+
 class LKEngine {
 public:
     typedef std::list<LKLayer*>   LKLayerList;
@@ -45,25 +88,107 @@ public:
     LKEngine(LKLayer* root);
     ~LKEngine(void);
 
+	/** the way the layer tree is rendered each frame. RENDER_RECURSIVE calls
+	 *  LKLayer::display() on the root once for each render stage.
+	 *  RENDER_DRAW_LISTS walks the tree once per frame, sorting the visible
+	 *  layers into opaque, transparent and post draw lists which are then
+	 *  drawn in order */
+	enum RenderMode {RENDER_RECURSIVE, RENDER_DRAW_LISTS};
+
 	void initViewportTexture(void);
 
 	/** returns the number of ticks passed since the LKEngine
 	 *  was created */
 	static int getTicks(void);
+	typedef int (*TickFunction)(void);
+	/** makes getTicks() return the result of f, so that time can be
+	 *  driven by a replay rather than the clock. NULL restores the
+	 *  clock */
+	static void setTickFunction(TickFunction f);
 		
 	/** returns the root layer of the engine */
     LKLayer* root(void) const;
 
+	/** returns the layer attached to this engine with the specified tag,
+	 *  or NULL if there is none. Constant time */
+	LKLayer* layerWithTag(const int tag) const;
+	/** returns the layer referred to by handle, or NULL if that layer has
+	 *  since been removed from the engine */
+	LKLayer* layerForHandle(const LKLayerHandle& handle) const;
+	/** returns the number of layers attached to the engine */
+	int layerCount(void) const;
+
+	/** when set, the position, position offset, rotation, scale and opacity
+	 *  of every attached layer are kept in the engine's transform store
+	 *  rather than in the layer objects. The LKLayer accessors behave the
+	 *  same either way */
+	bool usesTransformStore(void) const;
+	void setUsesTransformStore(bool v);
+	/** the per-engine component arrays, indexed by LKLayerHandle::index.
+	 *  Only meaningful while usesTransformStore() is set */
+	LKTransformStore& transformStore(void);
+	/** rebuilds the cached transforms of the layers in count slots from
+	 *  firstSlot. Must be called after writing to the transform store */
+	void transformStoreDidChange(int firstSlot, int count);
+
     void   callDisplay(void);
+	/** starts a frame: handles the queued events and steps the running
+	 *  animations. Called by render() */
+	void   update(void);
+	/** updates the engine and draws the layer tree to the screen */
 	void   render(void);
+	/** draws the layer tree into the viewport texture without updating
+	 *  the engine, so a frame drawn to both a texture and the screen
+	 *  handles its events once. Draws the engine as last updated; call
+	 *  update() first in a frame that is only drawn to the texture */
 	GLuint renderToTexture(void);
 
+	RenderMode renderMode(void) const;
+	void setRenderMode(RenderMode mode);
+
 	const double FOV(void) const;
 	void setFOV(double fov);
 
 	void windowDidResize(int width, int height);
 
+	/** the projection and camera matrices the engine renders with. These
+	 *  are kept on the CPU so that coordinate conversions need neither a
+	 *  GL context nor a round trip to the GL matrix stacks */
+	const Matrix4d& projectionMatrix(void) const;
+	const Matrix4d& viewMatrix(void) const;
+	/** the viewport as x, y, width, height */
+	const int* viewport(void) const;
+	/** the view volume of the current frame, in the coordinate system of
+	 *  the root layer */
+	const Frustumd& frustum(void) const;
+
+	/** when set, layers and subtrees whose bounds lie outside the view
+	 *  frustum are not drawn. Their animators are still updated. Off by
+	 *  default, as bounds need only cover the area a layer is hit in,
+	 *  and may not cover everything it draws */
+	bool cullsLayers(void) const;
+	void setCullsLayers(bool v);
+
+	/** the running animations of the layers attached to the engine,
+	 *  which update() steps at the start of each frame */
+	LKAnimationScheduler& animationScheduler(void);
+
+	/** returns the layers under the screen point p. The root layer always
+	 *  comes first, followed by the layers under the point ordered from
+	 *  nearest to furthest from the camera. Layers at the same depth are
+	 *  ordered topmost first. Uses a bounding volume hierarchy over the
+	 *  layers, so only layers near the point are tested */
 	LKLayerVector hitTest(Coord2d& p);
+	/** fills hits with the layers under the screen point p, in the order
+	 *  hitTest() returns them. The camera ray through p is intersected
+	 *  with the plane of each candidate layer on the CPU, using the
+	 *  regions cached in the pick tree, so no GL context is needed */
+	void pick(const Coord2d& p, LKHitList& hits);
+	/** picks several screen points in one walk of the pick tree, filling
+	 *  hits[i] as pick(points[i], hits[i]) would */
+	void pick(const vector<Coord2d>& points, vector<LKHitList>& hits);
+	/** returns the ray from the camera through the screen point p */
+	LKRay rayThroughPoint(const Coord2d& p) const;
     Coord2d convertPointToLayer(Coord2d& aPoint, LKLayer* aView);
 	//Coord3d convertPointtoOpenGLCoords(Coord2d& aPoint);
 	bool mouseIsInGLLayerContents(LKLayer* layer);
@@ -71,18 +196,158 @@ public:
 	/** updates the mouse position trail with the new position */
 	void updateMousePositionTrail(Coord2d c, int devId);
 
+	/** handles evt immediately. Handlers may call this for events of
+	 *  their own */
     void handleLKEvent(LKEvent* evt);
 
+	/** the layer key events are sent to first, or NULL. Key events bubble
+	 *  up from the first responder through its superlayers until one of
+	 *  them returns false from keydown(). Layers that want key events
+	 *  are then sent those that were not consumed */
+	LKLayer* firstResponder(void) const;
+	void setFirstResponder(LKLayer* layer);
+	/** queues evt to be handled at the start of the next frame. A motion
+	 *  or drag event replaces the previous queued event of the same type
+	 *  from the same device, accumulating its relative motion, so each
+	 *  device costs at most one hit test per frame however fast it
+	 *  reports. All other events are handled in the order they arrive */
+	void postLKEvent(const LKEvent* evt);
+	/** handles the events queued by postLKEvent(). Called by update() */
+	void processLKEvents(void);
+	/** sets a ring of events, usually filled by an LKInputThread, that
+	 *  processLKEvents() drains into the queue at the start of each
+	 *  frame. The ring is not owned by the engine */
+	void setInputRing(LKEventRing* ring);
+	LKEventRing* inputRing(void) const;
+	/** sets a recorder that is sent every event given to the engine from
+	 *  outside, and the start of each frame's event processing. Events
+	 *  the handlers post or handle while an event is dispatched are not
+	 *  recorded, as replaying the outer event makes them again. Not owned */
+	void setEventRecorder(LKEventRecorder* recorder);
+	LKEventRecorder* eventRecorder(void) const;
+
+	/** the picking work done since the last resetPickStats() */
+	const LKPickStats& pickStats(void) const;
+	void resetPickStats(void);
+
+private:
+	friend class LKLayer;
+	void registerLayer(LKLayer* layer);
+	void unregisterLayer(LKLayer* layer);
+	/** adds or removes layer from the layers that want key events. Both
+	 *  are constant time */
+	void addKeyListener(LKLayer* layer);
+	void removeKeyListener(LKLayer* layer);
+	/** closes the slots of listeners removed while dispatching */
+	void compactKeyListeners(void);
+	void handleKeyEvent(LKEvent* evt);
+	void dispatchLKEvent(LKEvent* evt);
+
+	/** draws the layer tree with the current projection and viewport */
+	void drawLayerTree(void);
+	/** appends layer and its visible sublayers to the draw lists */
+	void buildDrawLists(LKLayer* layer, long millisecondsPast);
+	void drawDrawList(const LKDrawList& list, bool postDraw);
+	/** rebuilds m_projection from the field of view and the viewport */
+	void updateProjection(void);
+
+	/** queues layer's leaf in the pick tree to be refit */
+	void layerPickBoundsDidChange(LKLayer* layer);
+	/** refits the leaves of the layers that have moved or changed bounds
+	 *  since the last hit test */
+	void updatePickTree(void);
+	/** the plane and rectangle a layer is hit tested against. The plane is
+	 *  parallel to the screen through origin, and rect is relative to
+	 *  origin, both in the coordinate system of the root layer */
+	struct PickRegion {
+		Coord3d origin;
+		Coord4d rect;
+
+		Box3d box(void) const;
+	};
+
+	PickRegion pickRegion(LKLayer* layer) const;
+	/** intersects ray with the plane of layer's pick region, filling in
+	 *  the local point and depth of hit. Returns false if the ray is
+	 *  parallel to the plane */
+	bool intersectPickRegion(const LKRay& ray, LKLayer* layer, LKHitRecord& hit) const;
+	/** fills hits with the root and those of candidates that ray hits
+	 *  exactly, in hit test order */
+	void resolvePick(const LKRay& ray, const vector<LKLayer*>& candidates, LKHitList& hits) const;
+	/** dispatches the entered, moved, dragged and exited events of a
+	 *  motion or drag event, given the layers under the device */
+	void handleMotionEvent(const LKEvent* srcEvent, const LKHitList& hits);
+	/** dispatches the run of motion events in m_processingEvents that
+	 *  starts at begin, resolving them in one walk of the pick tree.
+	 *  Returns the index of the first event not dispatched, which is
+	 *  earlier than the end of the run if a handler removed layers */
+	size_t handleMotionRun(size_t begin);
+
 private:
     double      m_yfov; /** field of view (in radians) */
     Coord3d     m_cameraPos;
+	Matrix4d    m_projection;
+	Matrix4d    m_view;
+	int         m_viewport[4];
+	Frustumd    m_frustum;
     LKLayer*    m_root;
 	vector<int> m_glIntersectLayers;
-    LKLayerList m_layersMouseIn[N_MOUSE_DEVICES];
+	/** the layers each device is over, sorted. Held by handle so that
+	 *  layers removed while hovered are dropped safely */
+	vector<LKLayerHandle> m_hovered[N_MOUSE_DEVICES];
 	GLuint      m_viewportTexture;
 	GLuint		m_frameBuffer;
 	GLuint		m_depthBuffer;
 	LKAnimator* m_animator;
+	RenderMode  m_renderMode;
+	LKLayerTable m_layerTable;
+	LKLayerBVH  m_pickTree;
+	vector<int> m_pickLeaves; /** the leaf of each layer, indexed by handle */
+	vector<PickRegion> m_pickRegions; /** indexed by handle */
+	vector<LKLayer*> m_pickCandidates;
+	vector<LKRay> m_pickRays;
+	vector< vector<LKLayer*> > m_batchCandidates;
+	vector<Coord2d> m_batchPoints;
+	vector<LKHitList> m_batchHits;
+	/** scratch space for handleLKEvent, kept to avoid allocating for
+	 *  every event. Each call takes the buffers while it runs, so a call
+	 *  made from a handler gets buffers of its own */
+	LKHitList   m_hits;
+	vector<LKLayerHandle> m_hitHandles;
+	vector<LKLayerHandle> m_wasHovered;
+	vector<LKLayerHandle> m_entered;
+	vector<LKLayerHandle> m_stillHovered;
+	vector<LKEvent> m_eventQueue;
+	vector<LKEvent> m_processingEvents;
+	/** the index in m_eventQueue of each device's last queued event */
+	int         m_lastQueuedEvent[N_MOUSE_DEVICES];
+	/** the number of layers removed from the engine so far, which tells
+	 *  event processing that layers it picked may have been freed */
+	unsigned    m_removedLayers;
+	vector<LKLayerHandle> m_pickRefitQueue;
+	LKLayerHandle m_firstResponder;
+	vector<LKLayerHandle> m_keyListeners;
+	vector<int> m_keyListenerIndices; /** the index of each layer in m_keyListeners, indexed by handle */
+	/** the listeners in the responder chain of the key event being
+	 *  dispatched, which have already been sent it */
+	vector<LKLayerHandle> m_keyVisited;
+	/** the depth of nested key event dispatches. While dispatching,
+	 *  removed listeners leave a null handle in their slot */
+	int         m_keyDispatchDepth;
+	bool        m_hasKeyListenerRemovals;
+	LKTransformStore m_transformStore;
+	LKAnimationScheduler m_animationScheduler;
+	bool        m_usesTransformStore;
+	bool        m_cullsLayers;
+	LKEventRing* m_inputRing;
+	LKEventRecorder* m_recorder;
+	/** the depth of nested event dispatches; only events given to the
+	 *  engine outside of any dispatch are recorded */
+	int         m_eventDispatchDepth;
+	LKPickStats m_pickStats;
+	LKDrawList  m_opaqueList;
+	LKDrawList  m_transparentList;
+	LKDrawList  m_postDrawList;
 };
 
 #endif
\ No newline at end of file
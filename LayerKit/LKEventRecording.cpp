@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ */
+#include "LKEventRecording.h"
+
+#include <algorithm>
+#include <string.h>
+#include <time.h>
+
+
+static const char          magic[4] = {'L', 'K', 'E', 'V'};
+static const unsigned char version  = 1;
+
+
+static void putInt(std::vector<unsigned char>& out, int v)
+{
+	unsigned int u = static_cast<unsigned int>(v);
+	for (int i = 0; i < 4; i++)
+		out.push_back(static_cast<unsigned char>(u >> (8 * i)));
+}
+
+static void putDouble(std::vector<unsigned char>& out, double v)
+{
+	unsigned char bytes[8];
+	memcpy(bytes, &v, 8);
+	// doubles are assumed to share the byte order of integers
+	unsigned int probe = 1;
+	bool isLittleEndian = *reinterpret_cast<unsigned char*>(&probe) == 1;
+	for (int i = 0; i < 8; i++)
+		out.push_back(bytes[isLittleEndian ? i : 7 - i]);
+}
+
+/** reads from a buffer, remembering if it ran past the end */
+class RecordReader {
+public:
+	RecordReader(const std::vector<unsigned char>& data)
+		: m_data(data)
+		, m_pos(0)
+		, m_failed(false)
+	{
+	}
+
+	bool atEnd(void) const
+	{
+		return m_pos >= m_data.size();
+	}
+
+	bool failed(void) const
+	{
+		return m_failed;
+	}
+
+	unsigned char getByte(void)
+	{
+		if (!ensure(1))
+			return 0;
+		return m_data[m_pos++];
+	}
+
+	int getInt(void)
+	{
+		if (!ensure(4))
+			return 0;
+		unsigned int u = 0;
+		for (int i = 0; i < 4; i++)
+			u |= static_cast<unsigned int>(m_data[m_pos++]) << (8 * i);
+		return static_cast<int>(u);
+	}
+
+	double getDouble(void)
+	{
+		if (!ensure(8))
+			return 0;
+		unsigned char bytes[8];
+		unsigned int probe = 1;
+		bool isLittleEndian = *reinterpret_cast<unsigned char*>(&probe) == 1;
+		for (int i = 0; i < 8; i++)
+			bytes[isLittleEndian ? i : 7 - i] = m_data[m_pos++];
+		double v;
+		memcpy(&v, bytes, 8);
+		return v;
+	}
+
+private:
+	bool ensure(size_t n)
+	{
+		if (m_pos + n > m_data.size())
+			m_failed = true;
+		return !m_failed;
+	}
+
+	const std::vector<unsigned char>& m_data;
+	size_t m_pos;
+	bool   m_failed;
+};
+
+/** microseconds from an arbitrary fixed point */
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
+
+static void sleepMicros(double micros)
+{
+	if (micros <= 0)
+		return;
+	struct timespec ts;
+	ts.tv_sec  = static_cast<time_t>(micros / 1e6);
+	ts.tv_nsec = static_cast<long>((micros - ts.tv_sec * 1e6) * 1e3);
+	nanosleep(&ts, NULL);
+}
+
+
+LKEventRecorder::LKEventRecorder(void)
+	: m_file(NULL)
+	, m_recordCount(0)
+	, m_openedMicros(0)
+{
+}
+
+LKEventRecorder::~LKEventRecorder(void)
+{
+	close();
+}
+
+bool LKEventRecorder::open(const char* path)
+{
+	close();
+	m_file = fopen(path, "wb");
+	if (m_file == NULL)
+		return false;
+	fwrite(magic, 1, sizeof(magic), m_file);
+	fwrite(&version, 1, 1, m_file);
+	m_recordCount  = 0;
+	m_openedMicros = now();
+	return true;
+}
+
+void LKEventRecorder::close(void)
+{
+	if (m_file == NULL)
+		return;
+	fclose(m_file);
+	m_file = NULL;
+}
+
+bool LKEventRecorder::isOpen(void) const
+{
+	return m_file != NULL;
+}
+
+void LKEventRecorder::record(LKEventRecord::Kind kind, const LKEvent* evt)
+{
+	if (m_file == NULL)
+		return;
+
+	const int ticks = static_cast<int>((now() - m_openedMicros) / 1e3);
+	m_buffer.clear();
+	m_buffer.push_back(static_cast<unsigned char>(kind));
+	putInt(m_buffer, ticks);
+	if (kind != LKEventRecord::FRAME){
+		putInt(m_buffer, evt->deviceID);
+		putInt(m_buffer, evt->type);
+		putDouble(m_buffer, evt->screenLocation.x);
+		putDouble(m_buffer, evt->screenLocation.y);
+		putDouble(m_buffer, evt->relativeMotion.x);
+		putDouble(m_buffer, evt->relativeMotion.y);
+		m_buffer.push_back(static_cast<unsigned char>(evt->buttonID));
+		putInt(m_buffer, evt->scrollDelta);
+		putInt(m_buffer, evt->key);
+	}
+	fwrite(&m_buffer[0], 1, m_buffer.size(), m_file);
+	m_recordCount++;
+}
+
+int LKEventRecorder::recordCount(void) const
+{
+	return m_recordCount;
+}
+
+
+double LKReplayReport::meanMicros(void) const
+{
+	return samples.empty() ? 0 : totalMicros / samples.size();
+}
+
+double LKReplayReport::percentileMicros(double p) const
+{
+	if (samples.empty())
+		return 0;
+	std::vector<double> times;
+	times.reserve(samples.size());
+	for (size_t i = 0; i < samples.size(); i++)
+		times.push_back(samples[i].micros);
+	size_t n = static_cast<size_t>(p * (times.size() - 1) + 0.5);
+	n = std::min(n, times.size() - 1);
+	std::nth_element(times.begin(), times.begin() + n, times.end());
+	return times[n];
+}
+
+
+bool LKEventReplayer::load(const char* path)
+{
+	m_records.clear();
+	FILE* file = fopen(path, "rb");
+	if (file == NULL)
+		return false;
+	std::vector<unsigned char> data;
+	unsigned char chunk[4096];
+	size_t n;
+	while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		data.insert(data.end(), chunk, chunk + n);
+	fclose(file);
+
+	if (data.size() < sizeof(magic) + 1 || memcmp(&data[0], magic, sizeof(magic)) != 0 || data[sizeof(magic)] != version)
+		return false;
+	data.erase(data.begin(), data.begin() + sizeof(magic) + 1);
+
+	RecordReader reader(data);
+	while (!reader.atEnd()){
+		LKEventRecord record;
+		record.kind  = static_cast<LKEventRecord::Kind>(reader.getByte());
+		record.ticks = reader.getInt();
+		if (record.kind > LKEventRecord::FRAME)
+			break;
+		if (record.kind != LKEventRecord::FRAME){
+			LKEvent& evt = record.event;
+			evt.deviceID         = reader.getInt();
+			evt.type             = static_cast<EventType>(reader.getInt());
+			evt.screenLocation.x = reader.getDouble();
+			evt.screenLocation.y = reader.getDouble();
+			evt.relativeMotion.x = reader.getDouble();
+			evt.relativeMotion.y = reader.getDouble();
+			evt.buttonID         = static_cast<ButtonID>(reader.getByte());
+			evt.scrollDelta      = reader.getInt();
+			evt.key              = static_cast<LKKey>(reader.getInt());
+		}
+		if (reader.failed())
+			break;
+		m_records.push_back(record);
+	}
+	// a recording cut short keeps the records that were complete
+	return true;
+}
+
+const std::vector<LKEventRecord>& LKEventReplayer::records(void) const
+{
+	return m_records;
+}
+
+/** the ticks of the record being replayed */
+static int replayTicks = 0;
+
+static int getReplayTicks(void)
+{
+	return replayTicks;
+}
+
+void LKEventReplayer::replay(LKEngine& engine, Pace pace, LKReplayReport& report)
+{
+	report.samples.clear();
+	report.samples.reserve(m_records.size());
+	report.totalMicros = 0;
+	engine.resetPickStats();
+	report.picks = engine.pickStats();
+	if (m_records.empty())
+		return;
+
+	LKEngine::setTickFunction(getReplayTicks);
+	const int    firstTick = m_records.front().ticks;
+	const double start     = now();
+	for (size_t i = 0; i < m_records.size(); i++){
+		LKEventRecord record = m_records[i];
+		if (pace == RECORDED_PACE)
+			sleepMicros(start + (record.ticks - firstTick) * 1e3 - now());
+		replayTicks = record.ticks;
+
+		const LKPickStats before = engine.pickStats();
+		const double began = now();
+		if (record.kind == LKEventRecord::POSTED)
+			engine.postLKEvent(&record.event);
+		else if (record.kind == LKEventRecord::HANDLED)
+			engine.handleLKEvent(&record.event);
+		else
+			engine.processLKEvents();
+
+		LKReplaySample sample;
+		sample.kind   = record.kind;
+		sample.type   = record.kind == LKEventRecord::FRAME ? 0 : record.event.type;
+		sample.micros = now() - began;
+		const LKPickStats& after = engine.pickStats();
+		sample.picks.rays       = after.rays - before.rays;
+		sample.picks.candidates = after.candidates - before.candidates;
+		sample.picks.hits       = after.hits - before.hits;
+		report.samples.push_back(sample);
+		report.totalMicros += sample.micros;
+	}
+	report.picks = engine.pickStats();
+	LKEngine::setTickFunction(NULL);
+}
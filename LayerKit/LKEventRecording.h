@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ */
+#ifndef LKEventRecording_h
+#define LKEventRecording_h
+
+#include <stdio.h>
+#include <vector>
+#include "LKEngine.h"
+#include "LKLayer.h"
+
+
+/** an event given to an engine, or the start of a frame's event
+ *  processing, and when it happened */
+struct LKEventRecord {
+	enum Kind {
+		POSTED,  /** given to LKEngine::postLKEvent() */
+		HANDLED, /** given to LKEngine::handleLKEvent() */
+		FRAME    /** LKEngine::processLKEvents() was called */
+	};
+
+	Kind    kind;
+	int     ticks; /** milliseconds since the recording was opened */
+	LKEvent event; /** unused for FRAME records */
+};
+
+
+/** writes the events an engine is given to a file, to be replayed later
+ *  by LKEventReplayer. Attach it with LKEngine::setEventRecorder().
+ *
+ *  The file starts with the bytes "LKEV" and a format version, followed
+ *  by the records. Each record is a kind byte and the ticks; event
+ *  records go on with the device, type, screen location, relative
+ *  motion, button, scroll delta and key. Integers and doubles are
+ *  stored little endian */
+class LKEventRecorder {
+public:
+	LKEventRecorder(void);
+	~LKEventRecorder(void);
+
+	/** starts a new recording at path, returning false on error */
+	bool open(const char* path);
+	void close(void);
+	bool isOpen(void) const;
+
+	/** writes a record stamped with the time since open(), read from a
+	 *  monotonic clock rather than LKEngine::getTicks() */
+	void record(LKEventRecord::Kind kind, const LKEvent* evt);
+	/** the number of records written since open() */
+	int recordCount(void) const;
+
+private:
+	// recorders are not copyable
+	LKEventRecorder(const LKEventRecorder&);
+	LKEventRecorder& operator=(const LKEventRecorder&);
+
+	FILE*  m_file;
+	int    m_recordCount;
+	double m_openedMicros;
+	std::vector<unsigned char> m_buffer;
+};
+
+
+/** the cost of replaying one record */
+struct LKReplaySample {
+	LKEventRecord::Kind kind;
+	int         type;   /** the event type, or 0 for FRAME records */
+	double      micros; /** the time taken to dispatch the record */
+	LKPickStats picks;  /** the picking done dispatching the record */
+};
+
+struct LKReplayReport {
+	std::vector<LKReplaySample> samples;
+	double      totalMicros;
+	LKPickStats picks;
+
+	double meanMicros(void) const;
+	/** the dispatch time that fraction p of the samples do not exceed */
+	double percentileMicros(double p) const;
+};
+
+
+/** plays a recording made by LKEventRecorder back into an engine.
+ *  POSTED and HANDLED records are given to the engine as they were,
+ *  and FRAME records call LKEngine::processLKEvents(), so events are
+ *  coalesced and dispatched in the same frames as when recorded. While
+ *  replaying, LKEngine::getTicks() returns the ticks of the record being
+ *  replayed: the milliseconds since the recording was opened, not the
+ *  engine ticks of the recorded run. Anything driven by time sees the
+ *  same intervals between records as were recorded */
+class LKEventReplayer {
+public:
+	/** RECORDED_PACE waits between records as long as was recorded.
+	 *  AS_FAST_AS_POSSIBLE does not wait at all */
+	enum Pace {RECORDED_PACE, AS_FAST_AS_POSSIBLE};
+
+	/** reads the recording at path, returning false if it could not be
+	 *  read or is not a recording */
+	bool load(const char* path);
+	const std::vector<LKEventRecord>& records(void) const;
+
+	/** replays the records into engine, filling report with the time
+	 *  and picking work each took. Restores the clock when done */
+	void replay(LKEngine& engine, Pace pace, LKReplayReport& report);
+
+private:
+	std::vector<LKEventRecord> m_records;
+};
+
+
+#endif
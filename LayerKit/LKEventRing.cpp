@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ */
+#include "LKEventRing.h"
+
+
+LKEventRing::LKEventRing(size_t capacity)
+	: m_head(0)
+	, m_tail(0)
+{
+	size_t n = 2;
+	while (n < capacity)
+		n *= 2;
+	m_slots = new Slot[n];
+	m_mask  = n - 1;
+	for (size_t i = 0; i < n; i++)
+		m_slots[i].sequence.store(i, boost::memory_order_relaxed);
+}
+
+LKEventRing::~LKEventRing(void)
+{
+	delete[] m_slots;
+}
+
+bool LKEventRing::push(const LKEvent& evt)
+{
+	// there is only one writer, so the tail can be claimed without a
+	// compare and swap. The slot is free once its last reader has set
+	// its sequence to the tail
+	size_t pos  = m_tail.load(boost::memory_order_relaxed);
+	Slot&  slot = m_slots[pos & m_mask];
+	if (slot.sequence.load(boost::memory_order_acquire) != pos)
+		return false;
+
+	slot.event = evt;
+	slot.sequence.store(pos + 1, boost::memory_order_release);
+	m_tail.store(pos + 1, boost::memory_order_relaxed);
+	return true;
+}
+
+bool LKEventRing::pop(LKEvent& evt)
+{
+	size_t pos = m_head.load(boost::memory_order_relaxed);
+	for (;;){
+		Slot& slot = m_slots[pos & m_mask];
+		size_t seq = slot.sequence.load(boost::memory_order_acquire);
+		ptrdiff_t diff = static_cast<ptrdiff_t>(seq) - static_cast<ptrdiff_t>(pos + 1);
+		if (diff == 0){
+			// the slot has been written; race the other readers for it.
+			// On failure pos is reloaded with the current head
+			if (m_head.compare_exchange_weak(pos, pos + 1, boost::memory_order_relaxed)){
+				evt = slot.event;
+				// hand the slot back to the writer for its next lap
+				slot.sequence.store(pos + m_mask + 1, boost::memory_order_release);
+				return true;
+			}
+		} else if (diff < 0){
+			return false;
+		} else {
+			pos = m_head.load(boost::memory_order_relaxed);
+		}
+	}
+}
+
+size_t LKEventRing::size(void) const
+{
+	size_t head = m_head.load(boost::memory_order_relaxed);
+	size_t tail = m_tail.load(boost::memory_order_relaxed);
+	return tail > head ? tail - head : 0;
+}
+
+size_t LKEventRing::capacity(void) const
+{
+	return m_mask + 1;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ */
+#ifndef LKEventRing_h
+#define LKEventRing_h
+
+#include <boost/atomic.hpp>
+#include <cstddef>
+#include "LKLayer.h"
+
+
+/** a bounded queue of LKEvents that one thread writes and any number of
+ *  threads read, without locks. Each slot carries a sequence number that
+ *  tells readers when it has been written and the writer when it has
+ *  been read, so neither side ever waits on the other; push() fails when
+ *  the ring is full and pop() when it is empty */
+class LKEventRing {
+public:
+	/** creates a ring holding at least capacity events. The capacity is
+	 *  rounded up to a power of two */
+	explicit LKEventRing(size_t capacity = 1024);
+	~LKEventRing(void);
+
+	/** appends evt, returning false if the ring is full. Must only be
+	 *  called from the producing thread */
+	bool push(const LKEvent& evt);
+	/** removes the oldest event into evt, returning false if the ring is
+	 *  empty. May be called from any thread */
+	bool pop(LKEvent& evt);
+
+	/** an estimate of the number of events waiting. Exact only when no
+	 *  other thread is using the ring */
+	size_t size(void) const;
+	size_t capacity(void) const;
+
+private:
+	struct Slot {
+		boost::atomic<size_t> sequence;
+		LKEvent event;
+	};
+
+	// rings are not copyable
+	LKEventRing(const LKEventRing&);
+	LKEventRing& operator=(const LKEventRing&);
+
+	/** padding keeping the indices on their own cache lines, so readers
+	 *  and the writer do not contend for the same line */
+	enum {CACHE_LINE = 64};
+
+	Slot*  m_slots;
+	size_t m_mask;
+	char   m_pad0[CACHE_LINE];
+	boost::atomic<size_t> m_head; /** the next slot to read */
+	char   m_pad1[CACHE_LINE];
+	boost::atomic<size_t> m_tail; /** the next slot to write */
+	char   m_pad2[CACHE_LINE];
+};
+
+
+#endif
@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ */
+#include "LKInputThread.h"
+
+#include <algorithm>
+#include <boost/thread.hpp>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include "LKEngine.h"
+#include "LKEventRing.h"
+
+
+/** returns the LKKey for the evdev key code, or LKKEY_UNKNOWN */
+static LKKey keyForCode(int code)
+{
+	static const struct {
+		int   code;
+		LKKey key;
+	} keys[] = {
+		{KEY_ESC, LKKEY_ESCAPE}, {KEY_1, LKKEY_1}, {KEY_2, LKKEY_2},
+		{KEY_3, LKKEY_3}, {KEY_4, LKKEY_4}, {KEY_5, LKKEY_5},
+		{KEY_6, LKKEY_6}, {KEY_7, LKKEY_7}, {KEY_8, LKKEY_8},
+		{KEY_9, LKKEY_9}, {KEY_0, LKKEY_0}, {KEY_MINUS, LKKEY_MINUS},
+		{KEY_EQUAL, LKKEY_EQUALS}, {KEY_BACKSPACE, LKKEY_BACKSPACE},
+		{KEY_TAB, LKKEY_TAB}, {KEY_Q, LKKEY_q}, {KEY_W, LKKEY_w},
+		{KEY_E, LKKEY_e}, {KEY_R, LKKEY_r}, {KEY_T, LKKEY_t},
+		{KEY_Y, LKKEY_y}, {KEY_U, LKKEY_u}, {KEY_I, LKKEY_i},
+		{KEY_O, LKKEY_o}, {KEY_P, LKKEY_p}, {KEY_LEFTBRACE, LKKEY_LEFTBRACKET},
+		{KEY_RIGHTBRACE, LKKEY_RIGHTBRACKET}, {KEY_ENTER, LKKEY_RETURN},
+		{KEY_LEFTCTRL, LKKEY_LCTRL}, {KEY_A, LKKEY_a}, {KEY_S, LKKEY_s},
+		{KEY_D, LKKEY_d}, {KEY_F, LKKEY_f}, {KEY_G, LKKEY_g},
+		{KEY_H, LKKEY_h}, {KEY_J, LKKEY_j}, {KEY_K, LKKEY_k},
+		{KEY_L, LKKEY_l}, {KEY_SEMICOLON, LKKEY_SEMICOLON},
+		{KEY_APOSTROPHE, LKKEY_QUOTE}, {KEY_GRAVE, LKKEY_BACKQUOTE},
+		{KEY_LEFTSHIFT, LKKEY_LSHIFT}, {KEY_BACKSLASH, LKKEY_BACKSLASH},
+		{KEY_Z, LKKEY_z}, {KEY_X, LKKEY_x}, {KEY_C, LKKEY_c},
+		{KEY_V, LKKEY_v}, {KEY_B, LKKEY_b}, {KEY_N, LKKEY_n},
+		{KEY_M, LKKEY_m}, {KEY_COMMA, LKKEY_COMMA}, {KEY_DOT, LKKEY_PERIOD},
+		{KEY_SLASH, LKKEY_SLASH}, {KEY_RIGHTSHIFT, LKKEY_RSHIFT},
+		{KEY_LEFTALT, LKKEY_LALT}, {KEY_SPACE, LKKEY_SPACE},
+		{KEY_CAPSLOCK, LKKEY_CAPSLOCK}, {KEY_RIGHTCTRL, LKKEY_RCTRL},
+		{KEY_RIGHTALT, LKKEY_RALT}, {KEY_HOME, LKKEY_HOME},
+		{KEY_UP, LKKEY_UP}, {KEY_PAGEUP, LKKEY_PAGEUP},
+		{KEY_LEFT, LKKEY_LEFT}, {KEY_RIGHT, LKKEY_RIGHT},
+		{KEY_END, LKKEY_END}, {KEY_DOWN, LKKEY_DOWN},
+		{KEY_PAGEDOWN, LKKEY_PAGEDOWN}, {KEY_INSERT, LKKEY_INSERT},
+		{KEY_DELETE, LKKEY_DELETE}
+	};
+	for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+		if (keys[i].code == code)
+			return keys[i].key;
+	return LKKEY_UNKNOWN;
+}
+
+
+LKInputThread::LKInputThread(LKEventRing& ring)
+	: m_ring(ring)
+	, m_thread(NULL)
+	, m_running(false)
+	, m_screenWidth(0)
+	, m_screenHeight(0)
+{
+	m_wakePipe[0] = m_wakePipe[1] = -1;
+}
+
+LKInputThread::~LKInputThread(void)
+{
+	stop();
+	for (size_t i = 0; i < m_devices.size(); i++)
+		if (m_devices[i].fd >= 0)
+			close(m_devices[i].fd);
+}
+
+int LKInputThread::openDevice(const char* path)
+{
+	int fd = open(path, O_RDONLY | O_NONBLOCK);
+	if (fd < 0)
+		return -1;
+	return addDevice(fd);
+}
+
+int LKInputThread::addDevice(int fd)
+{
+	// the engine tracks the hovered layers of this many devices
+	if (m_devices.size() >= N_MOUSE_DEVICES){
+		close(fd);
+		return -1;
+	}
+
+	Device device;
+	device.fd                = fd;
+	device.state.deviceID    = static_cast<int>(m_devices.size());
+	device.state.type        = static_cast<EventType>(0);
+	device.state.buttonID    = NONE_BUTTON;
+	device.state.scrollDelta = 0;
+	device.state.key         = LKKEY_UNKNOWN;
+	device.motion         = Coord2d(0, 0);
+	device.scroll         = 0;
+	device.partialBytes   = 0;
+	m_devices.push_back(device);
+	return device.state.deviceID;
+}
+
+void LKInputThread::setScreenSize(int width, int height)
+{
+	m_screenWidth  = width;
+	m_screenHeight = height;
+}
+
+bool LKInputThread::start(void)
+{
+	if (m_thread != NULL)
+		return true;
+	if (pipe(m_wakePipe) != 0)
+		return false;
+	m_running = true;
+	m_thread  = new boost::thread(boost::bind(&LKInputThread::run, this));
+	return true;
+}
+
+void LKInputThread::stop(void)
+{
+	if (m_thread == NULL)
+		return;
+	m_running = false;
+	char wake = 0;
+	while (write(m_wakePipe[1], &wake, 1) < 0 && errno == EINTR)
+		;
+	m_thread->join();
+	delete m_thread;
+	m_thread = NULL;
+	close(m_wakePipe[0]);
+	close(m_wakePipe[1]);
+	m_wakePipe[0] = m_wakePipe[1] = -1;
+}
+
+bool LKInputThread::isRunning(void) const
+{
+	return m_running;
+}
+
+bool LKInputThread::writeInputEvent(int fd, int type, int code, int value)
+{
+	struct input_event ie;
+	memset(&ie, 0, sizeof(ie));
+	ie.type  = type;
+	ie.code  = code;
+	ie.value = value;
+	return write(fd, &ie, sizeof(ie)) == static_cast<ssize_t>(sizeof(ie));
+}
+
+void LKInputThread::run(void)
+{
+	// the wake pipe is polled last; a device that has ended is given a
+	// negative descriptor, which poll() ignores
+	std::vector<struct pollfd> fds(m_devices.size() + 1);
+	for (size_t i = 0; i < m_devices.size(); i++)
+		fds[i].fd = m_devices[i].fd;
+	fds.back().fd = m_wakePipe[0];
+	for (size_t i = 0; i < fds.size(); i++)
+		fds[i].events = POLLIN;
+
+	while (m_running){
+		if (poll(&fds[0], fds.size(), -1) < 0){
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		for (size_t i = 0; i < m_devices.size() && m_running; i++){
+			if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) == 0)
+				continue;
+			if (!readDevice(static_cast<int>(i)))
+				fds[i].fd = -1;
+		}
+	}
+	// stop() still joins a thread that has ended on an error
+	m_running = false;
+}
+
+bool LKInputThread::readDevice(int id)
+{
+	Device& device = m_devices[id];
+	char buffer[64 * sizeof(struct input_event)];
+	size_t offset = device.partialBytes;
+	memcpy(buffer, device.partial, offset);
+
+	ssize_t n = read(device.fd, buffer + offset, sizeof(buffer) - offset);
+	if (n < 0)
+		return errno == EAGAIN || errno == EINTR;
+	if (n == 0)
+		return false;
+
+	size_t available = offset + n;
+	size_t used      = 0;
+	for (; available - used >= sizeof(struct input_event); used += sizeof(struct input_event)){
+		struct input_event ie;
+		memcpy(&ie, buffer + used, sizeof(ie));
+		handleInput(id, ie.type, ie.code, ie.value);
+	}
+
+	// keep the start of an event the read split, to complete next time
+	device.partialBytes = available - used;
+	memcpy(device.partial, buffer + used, device.partialBytes);
+	return true;
+}
+
+void LKInputThread::handleInput(int id, int type, int code, int value)
+{
+	Device& device = m_devices[id];
+	LKEvent evt    = device.state;
+
+	switch (type){
+	case EV_REL:
+		if (code == REL_X)
+			device.motion.x += value;
+		else if (code == REL_Y)
+			device.motion.y += value;
+		else if (code == REL_WHEEL)
+			device.scroll += value;
+		break;
+
+	case EV_KEY:
+		if (code == BTN_LEFT || code == BTN_RIGHT){
+			// motion reported before the button moved the pointer
+			// while the button was still in its old state
+			flush(id);
+			evt = device.state;
+			ButtonID button = code == BTN_LEFT ? LEFT_BUTTON : RIGHT_BUTTON;
+			if (value == 1){
+				evt.type = code == BTN_LEFT ? DEV_LEFT_BUTTON_DOWN : DEV_RIGHT_BUTTON_DOWN;
+				device.state.buttonID = button;
+			} else if (value == 0){
+				evt.type = code == BTN_LEFT ? DEV_LEFT_BUTTON_UP : DEV_RIGHT_BUTTON_UP;
+				if (device.state.buttonID == button)
+					device.state.buttonID = NONE_BUTTON;
+			} else {
+				break;
+			}
+			evt.buttonID       = button;
+			evt.relativeMotion = Coord2d(0, 0);
+			emit(evt);
+		} else if (code < BTN_MISC && value != 0){
+			// key presses and repeats; LKEvent has no key up
+			evt.type           = DEV_KEY;
+			evt.key            = keyForCode(code);
+			evt.relativeMotion = Coord2d(0, 0);
+			emit(evt);
+		}
+		break;
+
+	case EV_SYN:
+		if (code == SYN_REPORT)
+			flush(id);
+		break;
+	}
+}
+
+void LKInputThread::flush(int id)
+{
+	Device& device = m_devices[id];
+
+	if (device.motion.x != 0 || device.motion.y != 0){
+		device.state.screenLocation += device.motion;
+		const int width  = m_screenWidth;
+		const int height = m_screenHeight;
+		if (width > 0 && height > 0){
+			Coord2d& location = device.state.screenLocation;
+			location.x = std::max(0.0, std::min(location.x, width - 1.0));
+			location.y = std::max(0.0, std::min(location.y, height - 1.0));
+		}
+		LKEvent evt = device.state;
+		if (device.state.buttonID == LEFT_BUTTON)
+			evt.type = DEV_LEFT_BUTTON_DRAGGED;
+		else if (device.state.buttonID == RIGHT_BUTTON)
+			evt.type = DEV_RIGHT_BUTTON_DRAGGED;
+		else
+			evt.type = DEV_MOTION;
+		evt.relativeMotion = device.motion;
+		device.motion      = Coord2d(0, 0);
+		emit(evt);
+	}
+
+	if (device.scroll != 0){
+		LKEvent evt        = device.state;
+		evt.type           = DEV_SCROLL_Y;
+		evt.scrollDelta    = device.scroll;
+		evt.relativeMotion = Coord2d(0, 0);
+		device.scroll      = 0;
+		emit(evt);
+	}
+}
+
+void LKInputThread::emit(const LKEvent& evt)
+{
+	// wait for the render thread to make room rather than lose the event
+	while (!m_ring.push(evt)){
+		if (!m_running)
+			return;
+		boost::this_thread::yield();
+	}
+}
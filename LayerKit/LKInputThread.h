@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ */
+#ifndef LKInputThread_h
+#define LKInputThread_h
+
+#include <boost/atomic.hpp>
+#include <vector>
+#include "LKLayer.h"
+
+
+class LKEventRing;
+namespace boost {
+	class thread;
+}
+
+
+/** reads Linux evdev input devices on a thread of its own, translating
+ *  their reports into LKEvents and pushing them onto an LKEventRing for
+ *  the render thread to drain. Relative pointing devices and keyboards
+ *  are understood; each device added is given the next device id, up
+ *  to the N_MOUSE_DEVICES the engine tracks the pointers of.
+ *
+ *  Devices are read from file descriptors, so anything that delivers
+ *  struct input_event records will do in place of a device node: a pipe
+ *  fed with writeInputEvent() makes a stand-in device for tests. When
+ *  the ring is full the thread waits for room rather than dropping
+ *  events, leaving the kernel to buffer the device */
+class LKInputThread {
+public:
+	explicit LKInputThread(LKEventRing& ring);
+	/** stops the thread and closes the devices */
+	~LKInputThread(void);
+
+	/** opens the evdev node at path, such as /dev/input/event3. Returns
+	 *  the device id of its events, or -1 if it could not be opened */
+	int openDevice(const char* path);
+	/** reads events from fd, which the thread takes ownership of.
+	 *  Returns the device id of its events, or -1 once N_MOUSE_DEVICES
+	 *  have been added, in which case fd is closed */
+	int addDevice(int fd);
+	/** pointers are kept within a screen of width by height. Until a
+	 *  size is set their locations are not bounded */
+	void setScreenSize(int width, int height);
+	/** devices must be added before the thread is started */
+	bool start(void);
+	void stop(void);
+	/** false once stopped, or once the thread has ended on an error */
+	bool isRunning(void) const;
+
+	/** writes one struct input_event to fd, returning false on error */
+	static bool writeInputEvent(int fd, int type, int code, int value);
+
+private:
+	struct Device {
+		int     fd;
+		LKEvent state;        /** the location and buttons of the device */
+		Coord2d motion;       /** motion since the last report */
+		int     scroll;       /** wheel movement since the last report */
+		size_t  partialBytes; /** bytes of an event split across reads */
+		char    partial[32];
+	};
+
+	void run(void);
+	/** reads what is available from device id, returning false at the
+	 *  end of its input */
+	bool readDevice(int id);
+	void handleInput(int id, int type, int code, int value);
+	/** sends the motion and scrolling gathered since the last report */
+	void flush(int id);
+	void emit(const LKEvent& evt);
+
+	// input threads are not copyable
+	LKInputThread(const LKInputThread&);
+	LKInputThread& operator=(const LKInputThread&);
+
+	LKEventRing&   m_ring;
+	std::vector<Device> m_devices;
+	boost::thread* m_thread;
+	int            m_wakePipe[2]; /** written by stop() to wake the thread */
+	boost::atomic<bool> m_running;
+	boost::atomic<int>  m_screenWidth;
+	boost::atomic<int>  m_screenHeight;
+};
+
+
+#endif
@@ -21,73 +21,103 @@
 #include "lklayer.h"
 
 #include <algorithm>
+#include <boost/atomic.hpp>
 #include <boost/foreach.hpp>
 #include <iostream>
 #include "platform/gl.h"
 #include "platform/MathExtras.h"
 #include "LKAnimation.h"
+#include "LKEngine.h"
 
 #define foreach BOOST_FOREACH
 
 
-static int  g_ntag       = 1;
+/** the last allocated tag. Layers may be created on any thread */
+static boost::atomic<int> g_ntag(0);
 static bool g_debugLayer = false;
 
 
 LKLayer::LKLayer(void)
-    : m_tag(g_ntag++) 
+    : m_tag(++g_ntag) 
     , m_isHidden(false)
     , m_bounds(-1, -1, 1, 1)
 	, m_autoComputeBounds(false)
+	, m_wantsKeyEvents(false)
 	, m_position(0, 0, 0)
     , m_scale(1, 1, 1)
 	, m_opacity(1.0)
     , m_superlayer(NULL)
+	, m_indexInSuperlayer(-1)
+	, m_animator(NULL)
+	, m_engine(NULL)
+	, m_transformStore(NULL)
+	, m_dirtyFlags(LOCAL_TRANSFORM_DIRTY | WORLD_TRANSFORM_DIRTY | BOUNDS_DIRTY | AUTO_BOUNDS_DIRTY)
 {
-	m_animator = new LKLinearAnimator(this);
 }
 
 LKLayer::LKLayer(Coord3d position)
-    : m_tag(g_ntag++) 
+    : m_tag(++g_ntag) 
     , m_isHidden(false)
     , m_bounds(-1, -1, 1, 1)
 	, m_autoComputeBounds(false)
+	, m_wantsKeyEvents(false)
 	, m_position(position)
     , m_scale(1, 1, 1)
 	, m_opacity(1.0)
     , m_superlayer(NULL)
+	, m_indexInSuperlayer(-1)
+	, m_animator(NULL)
+	, m_engine(NULL)
+	, m_transformStore(NULL)
+	, m_dirtyFlags(LOCAL_TRANSFORM_DIRTY | WORLD_TRANSFORM_DIRTY | BOUNDS_DIRTY | AUTO_BOUNDS_DIRTY)
 {
-	m_animator = new LKLinearAnimator(this);
 }
 
 LKLayer::LKLayer(Coord4d bounds)
-    : m_tag(g_ntag++) 
+    : m_tag(++g_ntag) 
     , m_isHidden(false)
     , m_bounds(bounds)
 	, m_autoComputeBounds(false)
+	, m_wantsKeyEvents(false)
 	, m_position(0, 0, 0)
     , m_scale(1, 1, 1)
 	, m_opacity(1.0)
     , m_superlayer(NULL)
+	, m_indexInSuperlayer(-1)
+	, m_animator(NULL)
+	, m_engine(NULL)
+	, m_transformStore(NULL)
+	, m_dirtyFlags(LOCAL_TRANSFORM_DIRTY | WORLD_TRANSFORM_DIRTY | BOUNDS_DIRTY | AUTO_BOUNDS_DIRTY)
 {	
-	m_animator = new LKLinearAnimator(this);
 }
 
 LKLayer::LKLayer(Coord3d position, Coord4d bounds)
-    : m_tag(g_ntag++) 
+    : m_tag(++g_ntag) 
     , m_isHidden(false)
     , m_bounds(bounds)
 	, m_autoComputeBounds(false)
+	, m_wantsKeyEvents(false)
 	, m_position(position)
     , m_scale(1, 1, 1)
 	, m_opacity(1.0)
     , m_superlayer(NULL)
+	, m_indexInSuperlayer(-1)
+	, m_animator(NULL)
+	, m_engine(NULL)
+	, m_transformStore(NULL)
+	, m_dirtyFlags(LOCAL_TRANSFORM_DIRTY | WORLD_TRANSFORM_DIRTY | BOUNDS_DIRTY | AUTO_BOUNDS_DIRTY)
 {
-	m_animator = new LKLinearAnimator(this);
 }
 
 LKLayer::~LKLayer(void)
 {
+	if (m_superlayer != NULL)
+		removeFromSuperlayer();
+	foreach (LKLayer* l, m_layers){
+		l->m_superlayer        = NULL;
+		l->m_indexInSuperlayer = -1;
+	}
+	setEngine(NULL);
     delete m_animator;
 }
 
@@ -108,6 +138,15 @@ LKLayer* LKLayer::layerWithTag(const int tag)
 {
     if (m_tag == tag)
         return this;
+    if (m_engine != NULL){
+        // the engine's table covers the whole tree, so check that
+        // the layer found is within this subtree
+        LKLayer* found = m_engine->layerWithTag(tag);
+        for (LKLayer* l = found; l != NULL; l = l->m_superlayer)
+            if (l == this)
+                return found;
+        return NULL;
+    }
     foreach (LKLayer* layer, m_layers){
         LKLayer* l = layer->layerWithTag(tag);
         if (l)
@@ -116,6 +155,53 @@ LKLayer* LKLayer::layerWithTag(const int tag)
     return NULL;
 }
 
+LKEngine* LKLayer::engine(void) const
+{
+    return m_engine;
+}
+
+LKLayerHandle LKLayer::handle(void) const
+{
+    return m_handle;
+}
+
+void LKLayer::setEngine(LKEngine* engine)
+{
+	if (m_engine == engine)
+		return;
+	if (m_engine != NULL)
+		m_engine->unregisterLayer(this);
+	m_engine = engine;
+	if (m_engine != NULL)
+		m_engine->registerLayer(this);
+	foreach (LKLayer* l, m_layers)
+		l->setEngine(engine);
+}
+
+void LKLayer::setTransformStore(LKTransformStore* store)
+{
+	if (m_transformStore == store)
+		return;
+	if (m_transformStore != NULL){
+		int slot = m_handle.index;
+		m_position       = m_transformStore->position(slot);
+		m_positionOffset = m_transformStore->positionOffset(slot);
+		m_rotation       = m_transformStore->rotation(slot);
+		m_scale          = m_transformStore->scale(slot);
+		m_opacity        = m_transformStore->opacity(slot);
+	}
+	m_transformStore = store;
+	if (m_transformStore != NULL){
+		int slot = m_handle.index;
+		m_transformStore->reserveSlots(slot + 1);
+		m_transformStore->position(slot)       = m_position;
+		m_transformStore->positionOffset(slot) = m_positionOffset;
+		m_transformStore->rotation(slot)       = m_rotation;
+		m_transformStore->scale(slot)          = m_scale;
+		m_transformStore->opacity(slot)        = m_opacity;
+	}
+}
+
 LKLayer* LKLayer::superlayer(void) const
 {
     return m_superlayer;
@@ -126,31 +212,157 @@ std::vector<LKLayer*> LKLayer::sublayers(void) const
     return m_layers;
 }
 
+LKLayer::SublayerIterator LKLayer::sublayersBegin(void) const
+{
+    return m_layers.begin();
+}
+
+LKLayer::SublayerIterator LKLayer::sublayersEnd(void) const
+{
+    return m_layers.end();
+}
+
+int LKLayer::sublayerCount(void) const
+{
+    return static_cast<int>(m_layers.size());
+}
+
+LKLayer* LKLayer::sublayerAtIndex(int index) const
+{
+    return m_layers[index];
+}
+
 void LKLayer::addSublayer(LKLayer* layer)
 {
-    layer->m_superlayer = this;
+    if (layer->m_superlayer != NULL)
+        layer->removeFromSuperlayer();
+    layer->m_superlayer        = this;
+    layer->m_indexInSuperlayer = static_cast<int>(m_layers.size());
     m_layers.push_back(layer);
+    layer->invalidateWorldTransform();
+    layer->setEngine(m_engine);
+    invalidateBounds();
 }
 
 void LKLayer::removeFromSuperlayer(void)
 {
-    typedef std::vector<LKLayer*> LayerVector;
-    for (LayerVector::iterator itr = m_superlayer->m_layers.begin(); itr != m_superlayer->m_layers.end(); ++itr){
-        if (*itr == this){
-            m_layers.erase(itr);
-            break;
-        }
+    if (m_superlayer == NULL)
+        return;
+
+    vector<LKLayer*>& siblings = m_superlayer->m_layers;
+    siblings.erase(siblings.begin() + m_indexInSuperlayer);
+    m_superlayer->reindexSublayers(m_indexInSuperlayer, static_cast<int>(siblings.size()));
+    detachFromSuperlayer();
+}
+
+void LKLayer::removeFromSuperlayerUnordered(void)
+{
+    if (m_superlayer == NULL)
+        return;
+
+    // fill this layer's slot with the last sibling
+    vector<LKLayer*>& siblings = m_superlayer->m_layers;
+    LKLayer* last = siblings.back();
+    siblings[m_indexInSuperlayer] = last;
+    last->m_indexInSuperlayer     = m_indexInSuperlayer;
+    siblings.pop_back();
+    detachFromSuperlayer();
+}
+
+void LKLayer::detachFromSuperlayer(void)
+{
+    m_superlayer->invalidateBounds();
+    m_superlayer        = NULL;
+    m_indexInSuperlayer = -1;
+    invalidateWorldTransform();
+    setEngine(NULL);
+}
+
+void LKLayer::removeSublayers(const vector<LKLayer*>& layers)
+{
+    // detach the layers being removed, then close the gaps they leave
+    // in one pass
+    foreach (LKLayer* l, layers)
+        if (l->m_superlayer == this)
+            l->m_superlayer = NULL;
+
+    int n = 0;
+    for (size_t i = 0; i < m_layers.size(); i++){
+        LKLayer* l = m_layers[i];
+        if (l->m_superlayer != this)
+            continue;
+        l->m_indexInSuperlayer = n;
+        m_layers[n++] = l;
+    }
+    m_layers.resize(n);
+    invalidateBounds();
+
+    foreach (LKLayer* l, layers){
+        if (l->m_superlayer != NULL || l->m_indexInSuperlayer < 0)
+            continue;
+        l->m_indexInSuperlayer = -1;
+        l->invalidateWorldTransform();
+        l->setEngine(NULL);
     }
 }
 
+void LKLayer::moveSublayers(int index, int count, LKLayer* superlayer)
+{
+    if (superlayer == this || count <= 0)
+        return;
+
+    superlayer->m_layers.reserve(superlayer->m_layers.size() + count);
+    for (int i = index; i < index + count; i++){
+        LKLayer* l = m_layers[i];
+        l->m_superlayer        = superlayer;
+        l->m_indexInSuperlayer = static_cast<int>(superlayer->m_layers.size());
+        superlayer->m_layers.push_back(l);
+        l->invalidateWorldTransform();
+        l->setEngine(superlayer->m_engine);
+    }
+
+    m_layers.erase(m_layers.begin() + index, m_layers.begin() + index + count);
+    reindexSublayers(index, static_cast<int>(m_layers.size()));
+    invalidateBounds();
+    superlayer->invalidateBounds();
+}
+
+void LKLayer::exchangeSublayersAtIndices(int i, int j)
+{
+    std::swap(m_layers[i], m_layers[j]);
+    m_layers[i]->m_indexInSuperlayer = i;
+    m_layers[j]->m_indexInSuperlayer = j;
+}
+
+void LKLayer::moveSublayerToIndex(LKLayer* layer, int index)
+{
+    int from = layer->m_indexInSuperlayer;
+    if (from < index)
+        std::rotate(m_layers.begin() + from, m_layers.begin() + from + 1, m_layers.begin() + index + 1);
+    else if (from > index)
+        std::rotate(m_layers.begin() + index, m_layers.begin() + from, m_layers.begin() + from + 1);
+    reindexSublayers(std::min(from, index), std::max(from, index) + 1);
+}
+
+int LKLayer::indexInSuperlayer(void) const
+{
+    return m_indexInSuperlayer;
+}
+
+void LKLayer::reindexSublayers(int from, int to)
+{
+    for (int i = from; i < to; i++)
+        m_layers[i]->m_indexInSuperlayer = i;
+}
+
 Coord2d LKLayer::convertPointToLayer(const Coord2d& p, LKLayer& alayer)
 {
     //         ..C
     //      ..D  .    DE / AE = CB / AB
     //    ..  .  .    DE = (CB/AB) * AE
     //   A....E..B    
-    double y = p.y / m_position.z * alayer.position().z;
-    double x = p.x / m_position.z * alayer.position().z;
+    double y = p.y / position().z * alayer.position().z;
+    double x = p.x / position().z * alayer.position().z;
     x /= alayer.scale().x;
     y /= alayer.scale().y;
     return Coord2d(x, y);
@@ -183,71 +395,73 @@ Coord2d LKLayer::convertPointToLayer(const Coord2d& aPoint)
 	return Coord2d(posX - offset.x, posY - offset.y);
 }
 */
+void LKLayer::screenTransform(Matrix4d& modelview, Matrix4d& projection, int viewport[4]) const
+{
+	if (m_engine != NULL){
+		modelview  = m_engine->viewMatrix() * worldContentTransform();
+		projection = m_engine->projectionMatrix();
+		for (int i = 0; i < 4; i++)
+			viewport[i] = m_engine->viewport()[i];
+	} else {
+		// a detached layer has no camera, so fall back to whatever
+		// OpenGL currently has loaded
+		glGetDoublev(GL_MODELVIEW_MATRIX, modelview.m);
+		glGetDoublev(GL_PROJECTION_MATRIX, projection.m);
+		glGetIntegerv(GL_VIEWPORT, viewport);
+	}
+}
+
 Coord3d LKLayer::convertScreenToLayerWithZValue(const Coord2d aPoint, double zValue)
 {
-	Coord3d offset(0,0,0);
-	convertFromVWorld(offset);
+	int viewport[4];
+	Matrix4d modelview;
+	Matrix4d projection;
+	Matrix4d inverse;
+	screenTransform(modelview, projection, viewport);
+	if (!(projection * modelview).inverse(inverse))
+		return Coord3d(0, 0, zValue);
 
-	GLint viewport[4];
-	GLdouble modelview[16];
-	GLdouble projection[16];
-	GLfloat winX, winY, winZ;
-	GLdouble posX, posY, posZ;
+	Coord3d win;
+	projectPoint(Coord3d(0, 0, zValue), modelview, projection, viewport, win);
+	win.x = aPoint.x;
+	win.y = aPoint.y;//viewport[3] - aPoint.y);
 
-	glGetDoublev( GL_MODELVIEW_MATRIX, modelview );
-	glGetDoublev( GL_PROJECTION_MATRIX, projection );
-	glGetIntegerv( GL_VIEWPORT, viewport );
-
-	GLdouble wx, wy, wz;
-	gluProject(0, 0, zValue, modelview, projection, viewport, &wx, &wy, &wz);
-
-	winX = float(aPoint.x);
-	winY = float(aPoint.y);//viewport[3] - aPoint.y);
-	winZ = wz;
+	Coord3d pos;
+	unprojectPoint(win, inverse, viewport, pos);
 
-	int i = gluUnProject(winX, winY, winZ, modelview, projection, viewport, &posX, &posY, &posZ);
-
-	return Coord3d(posX, posY, zValue);
+	return Coord3d(pos.x, pos.y, zValue);
 }
 
 Coord3d LKLayer::convertLayerToScreen(const Coord3d aPoint)
 {
-	Coord3d offset(0,0,0);
-	convertFromVWorld(offset);
-
-	GLint viewport[4];
-	GLdouble modelview[16];
-	GLdouble projection[16];
-	glGetDoublev(GL_MODELVIEW_MATRIX, modelview);
-	glGetDoublev(GL_PROJECTION_MATRIX, projection);
-	glGetIntegerv(GL_VIEWPORT, viewport);
+	int viewport[4];
+	Matrix4d modelview;
+	Matrix4d projection;
+	screenTransform(modelview, projection, viewport);
 
-	GLdouble wx, wy, wz;
-	gluProject(aPoint.x, aPoint.y, aPoint.z, modelview, projection, viewport, &wx, &wy, &wz);
+	Coord3d win;
+	projectPoint(aPoint, modelview, projection, viewport, win);
 
-	return Coord3d(wx, wy, wz);
+	return win;
 }
 
 Coord3d LKLayer::projectLayerToZValue(const Coord3d aPoint, double zValue)
 {
-	Coord3d offset(0,0,0);
-	//convertFromVWorld(offset);
+	int viewport[4];
+	Matrix4d modelview;
+	Matrix4d projection;
+	Matrix4d inverse;
+	screenTransform(modelview, projection, viewport);
+	if (!(projection * modelview).inverse(inverse))
+		return Coord3d(aPoint.x, aPoint.y, zValue);
 
-	GLint viewport[4];
-	GLdouble modelview[16];
-	GLdouble projection[16];
-	GLdouble posX, posY, posZ;
+	Coord3d win;
+	projectPoint(aPoint, modelview, projection, viewport, win);
 
-	glGetDoublev( GL_MODELVIEW_MATRIX, modelview );
-	glGetDoublev( GL_PROJECTION_MATRIX, projection );
-	glGetIntegerv( GL_VIEWPORT, viewport );
-
-	GLdouble wx, wy, wz;
-	gluProject(aPoint.x, aPoint.y, aPoint.z + offset.z, modelview, projection, viewport, &wx, &wy, &wz);
+	Coord3d pos;
+	unprojectPoint(win, inverse, viewport, pos);
 
-	int i = gluUnProject(wx, wy, wz, modelview, projection, viewport, &posX, &posY, &posZ);
-
-	return Coord3d(posX, posY, zValue);
+	return Coord3d(pos.x, pos.y, zValue);
 }
 
 bool LKLayer::mouseInRect(const Coord2d& p, const Coord4d& rect)
@@ -257,17 +471,23 @@ bool LKLayer::mouseInRect(const Coord2d& p, const Coord4d& rect)
 
 const Coord4d LKLayer::bounds(void) const
 {
-    return m_bounds * m_scale.x;
+    if (m_autoComputeBounds && (m_dirtyFlags & AUTO_BOUNDS_DIRTY))
+        computeBoundsFromSublayers();
+    return m_bounds * scale().x;
 }
 
 void LKLayer::setBounds(const Coord4d& bounds)
 {
     m_bounds = bounds;
+    invalidateBounds();
+    invalidatePickBounds();
 }
 
 void LKLayer::setBounds(const double& t, const double& u, const double& v, const double& w)
 {
     m_bounds.set(t, u, v, w);
+    invalidateBounds();
+    invalidatePickBounds();
 }
 
 bool LKLayer::autoComputeBounds(void)
@@ -278,110 +498,255 @@ bool LKLayer::autoComputeBounds(void)
 void LKLayer::setAutoComputeBounds(bool v)
 {
 	m_autoComputeBounds = v;
+	invalidateBounds();
+	invalidatePickBounds();
 }
 
 const Coord3d& LKLayer::position(void) const
 {
-    return m_position;
+    return m_transformStore ? m_transformStore->position(m_handle.index) : m_position;
 }
 
 void LKLayer::setPosition(const Coord3d& pos)
 {
-    m_position = pos;
-	if (m_animator->m_positionAnimator->isRunning())
+    positionRef() = pos;
+	invalidateTransform();
+	if (m_animator != NULL && m_animator->m_positionAnimator != NULL && m_animator->m_positionAnimator->isRunning())
 		m_animator->m_positionAnimator->stop();
 }
 
 void LKLayer::setPosition(const double& x, const double& y, const double& z)
 {
-    m_position.set(x, y, z);
+    positionRef().set(x, y, z);
+	invalidateTransform();
     //m_animator->setPosition(m_position);
 }
 
 void LKLayer::setXPosition(const double x)
 {
-	m_position.set(x, m_position.y, m_position.z);
+	positionRef().x = x;
+	invalidateTransform();
 }
 
 void LKLayer::setYPosition(const double y)
 {
-	m_position.set(m_position.x, y, m_position.z);
+	positionRef().y = y;
+	invalidateTransform();
 }
 
 void LKLayer::setZPosition(const double z)
 {
-	m_position.set(m_position.x, m_position.y, z);
+	positionRef().z = z;
+	invalidateTransform();
 }
 
 void LKLayer::setRelativePosition(const double& dx, const double& dy, const double& dz)
 {
-    m_position.x += dx;
-    m_position.y += dy;
-    m_position.z += dz;
+    positionRef() += Coord3d(dx, dy, dz);
+	invalidateTransform();
 }
 
 const Coord3d& LKLayer::positionOffset(void) const
 {
-	return m_positionOffset;
+	return m_transformStore ? m_transformStore->positionOffset(m_handle.index) : m_positionOffset;
 }
 
 void LKLayer::setPositionOffset(const Coord3d& pos)
 {
-	m_positionOffset = pos;
+	positionOffsetRef() = pos;
+	invalidateTransform();
 }
 
 const Coord3d& LKLayer::rotation(void) const
 {
-    return m_rotation;
+    return m_transformStore ? m_transformStore->rotation(m_handle.index) : m_rotation;
 }
 
 void LKLayer::setRotation(const Coord3d& pos)
 {
-    m_rotation = pos;
+    rotationRef() = pos;
+	invalidateTransform();
     //m_animator->setRotation(m_rotation);
 }
 
 void LKLayer::setRotation(const double& x, const double& y, const double& z)
 {
-    m_rotation.set(x, y, z);
+    rotationRef().set(x, y, z);
+	invalidateTransform();
     //m_animator->setRotation(m_rotation);
 }
 
 void LKLayer::setRelativeRotation(const double& dx, const double& dy, const double& dz)
 {
-    m_rotation.x += dx;
-    m_rotation.y += dy;
-    m_rotation.z += dz;
+    rotationRef() += Coord3d(dx, dy, dz);
+	invalidateTransform();
 }
 
 const Coord3d& LKLayer::scale(void) const
 {
-    return m_scale;
+    return m_transformStore ? m_transformStore->scale(m_handle.index) : m_scale;
 }
    
 void LKLayer::setScaleS(const double s)
 {
-    m_scale.set(s, s, s);
+    scaleRef().set(s, s, s);
+	invalidateTransform();
 }
 
 void LKLayer::setScale(const Coord3d& scale)
 {
-    m_scale = scale;
+    scaleRef() = scale;
+	invalidateTransform();
 }
 
 void LKLayer::setScale(const double& sx, const double& sy, const double& sz)
 {
-    m_scale.set(sx, sy, sz);
+    scaleRef().set(sx, sy, sz);
+	invalidateTransform();
 }
 
 const double LKLayer::opacity(void) const
 {
-	return m_opacity;
+	return m_transformStore ? m_transformStore->opacity(m_handle.index) : m_opacity;
 }
 
 void LKLayer::setOpacity(double v) 
 {
-	m_opacity = v;
+	opacityRef() = v;
+}
+
+const Box3d& LKLayer::worldBounds(void) const
+{
+	if (m_dirtyFlags & BOUNDS_DIRTY)
+		updateWorldBounds();
+	return m_worldBounds;
+}
+
+const Box3d& LKLayer::subtreeWorldBounds(void) const
+{
+	if (m_dirtyFlags & BOUNDS_DIRTY)
+		updateWorldBounds();
+	return m_subtreeWorldBounds;
+}
+
+const Matrix4d& LKLayer::localTransform(void) const
+{
+	if (m_dirtyFlags & LOCAL_TRANSFORM_DIRTY)
+		updateLocalTransform();
+	return m_localTransform;
+}
+
+const Matrix4d& LKLayer::contentTransform(void) const
+{
+	if (m_dirtyFlags & LOCAL_TRANSFORM_DIRTY)
+		updateLocalTransform();
+	return m_contentTransform;
+}
+
+const Matrix4d& LKLayer::worldTransform(void) const
+{
+	if (m_dirtyFlags & WORLD_TRANSFORM_DIRTY)
+		updateWorldTransform();
+	return m_worldTransform;
+}
+
+const Matrix4d& LKLayer::worldContentTransform(void) const
+{
+	if (m_dirtyFlags & WORLD_TRANSFORM_DIRTY)
+		updateWorldTransform();
+	return m_worldContentTransform;
+}
+
+void LKLayer::invalidateTransform(void)
+{
+	m_dirtyFlags |= LOCAL_TRANSFORM_DIRTY;
+	invalidateWorldTransform();
+	if (m_superlayer != NULL)
+		m_superlayer->invalidateBounds();
+}
+
+void LKLayer::invalidateWorldTransform(void)
+{
+	// the walk always covers the whole subtree. A layer's pick region
+	// can be queued on its own by a bounds change, so finding the flags
+	// already set says nothing about the layers below it
+	m_dirtyFlags |= WORLD_TRANSFORM_DIRTY | BOUNDS_DIRTY;
+	invalidatePickBounds();
+	foreach (LKLayer* l, m_layers)
+		l->invalidateWorldTransform();
+}
+
+void LKLayer::invalidateBounds(void)
+{
+	// the walk cannot stop at the first dirty layer: bounds() recomputes
+	// an auto computed layer on its own, leaving the flags of the layers
+	// below it set
+	for (LKLayer* l = this; l != NULL; l = l->m_superlayer){
+		l->m_dirtyFlags |= BOUNDS_DIRTY | AUTO_BOUNDS_DIRTY;
+		if (l->m_autoComputeBounds)
+			l->invalidatePickBounds();
+	}
+}
+
+void LKLayer::invalidatePickBounds(void)
+{
+	if (m_dirtyFlags & PICK_BOUNDS_DIRTY)
+		return;
+	m_dirtyFlags |= PICK_BOUNDS_DIRTY;
+	if (m_engine != NULL)
+		m_engine->layerPickBoundsDidChange(this);
+}
+
+void LKLayer::updateLocalTransform(void) const
+{
+	// equivalent to the glTranslate, glScale, glRotate sequence that
+	// display() used to issue for every layer in every render stage
+	const Coord3d& p = position();
+	const Coord3d& o = positionOffset();
+	const Coord3d& r = rotation();
+	const Coord3d& s = scale();
+	m_localTransform = Matrix4d::translation(p.x + o.x, p.y + o.y, p.z + o.z);
+	m_localTransform.scale(s.x, s.y, s.z);
+	m_localTransform.rotateZ(r.z);
+	m_localTransform.rotateY(r.y);
+	m_contentTransform = m_localTransform;
+	m_contentTransform.rotateX(r.x);
+	m_dirtyFlags &= ~LOCAL_TRANSFORM_DIRTY;
+}
+
+void LKLayer::updateWorldTransform(void) const
+{
+	if (m_dirtyFlags & LOCAL_TRANSFORM_DIRTY)
+		updateLocalTransform();
+	if (m_superlayer != NULL){
+		const Matrix4d& parent  = m_superlayer->worldTransform();
+		m_worldTransform        = parent * m_localTransform;
+		m_worldContentTransform = parent * m_contentTransform;
+	} else {
+		m_worldTransform        = m_localTransform;
+		m_worldContentTransform = m_contentTransform;
+	}
+	m_dirtyFlags &= ~WORLD_TRANSFORM_DIRTY;
+}
+
+void LKLayer::updateWorldBounds(void) const
+{
+	if (m_autoComputeBounds && (m_dirtyFlags & AUTO_BOUNDS_DIRTY))
+		computeBoundsFromSublayers();
+
+	const Matrix4d& t = worldContentTransform();
+	const Coord4d&  r = m_bounds;
+
+	m_worldBounds.setEmpty();
+	m_worldBounds.extend(t.transformPoint(Coord3d(r.t, r.u, 0)));
+	m_worldBounds.extend(t.transformPoint(Coord3d(r.v, r.u, 0)));
+	m_worldBounds.extend(t.transformPoint(Coord3d(r.v, r.w, 0)));
+	m_worldBounds.extend(t.transformPoint(Coord3d(r.t, r.w, 0)));
+
+	m_subtreeWorldBounds = m_worldBounds;
+	foreach (LKLayer* l, m_layers)
+		m_subtreeWorldBounds.extend(l->subtreeWorldBounds());
+	m_dirtyFlags &= ~BOUNDS_DIRTY;
 }
 
 void LKLayer::display(void)
@@ -394,21 +759,16 @@ void LKLayer::display(long millisecondsPast, RenderStage renderStage)
 	bool shouldRender = ((renderStage == DRAW) && (this->opacity() == 1.0)) ||
 						((renderStage == DRAW_TRANSPARENT) && (this->opacity() != 1.0));
 
-	if (shouldRender && millisecondsPast != 0 && m_animator)
-		this->m_animator->update(millisecondsPast);
-			
+	// the animations are updated by the engine's scheduler, so culled
+	// layers can still move into view
+	if (isCulled())
+		return;
+
     glPushMatrix();
-    glTranslated(m_position.x + m_positionOffset.x, 
-				 m_position.y + m_positionOffset.y, 
-				 m_position.z + m_positionOffset.z);
     glLoadName(tag());
-    glScaled(m_scale.x, m_scale.y, m_scale.z);
-    glRotated(m_rotation.z, 0, 0, 1.0);
-    glPushMatrix();
-	glRotated(m_rotation.y, 0, 1.0, 0);
     glPushMatrix();
-    glRotated(m_rotation.x, 1.0, 0, 0);
-	if (shouldRender && this->m_position.z <= 0)
+    glMultMatrixd(contentTransform().m);
+	if (shouldRender && this->position().z <= 0)
 		//if (renderStage == DRAW || renderStage == DRAW_TRANSPARENT)
 			this->draw();
 	else if (renderStage == POST_DRAW)
@@ -416,47 +776,62 @@ void LKLayer::display(long millisecondsPast, RenderStage renderStage)
     glPopMatrix();
 
 	// draw sublayers
+    glMultMatrixd(localTransform().m);
     foreach (LKLayer* l, m_layers){
         if (l->isHidden())
 			continue;
         l->display(millisecondsPast, renderStage);
     }
 
-    glPopMatrix();
     glPopMatrix();
 	 
-	// auto compute bounds if necessary
-	if (m_autoComputeBounds){
-		m_bounds.set(1000, 1000, -1000, -1000);
-		foreach (LKLayer* l, m_layers){
-			m_bounds.t = std::min(m_bounds.t, l->position().x + l->bounds().t);
-			m_bounds.u = std::min(m_bounds.u, l->position().y + l->bounds().u);
-			m_bounds.v = std::max(m_bounds.v, l->position().x + l->bounds().v);
-			m_bounds.w = std::max(m_bounds.w, l->position().y + l->bounds().w);
-		}
-	}
+	if (g_debugLayer)
+		drawDebugBounds();
+}
 
-	if (g_debugLayer){
-		glLoadName(0);
-
-		Coord4d bound = bounds();
-
-		glDisable(GL_DEPTH_TEST);
-		if (m_autoComputeBounds)
-			glColor3f(1.0f, 0.0f, 0.0f);
-		else
-			glColor3f(0.0f, 1.0f, 1.0f);
-		glBegin(GL_LINE_LOOP);
-		glVertex3d(m_position.x + bound.t, m_position.y + bound.u, m_position.z); 
-		glVertex3d(m_position.x + bound.v, m_position.y + bound.u, m_position.z);
-				
-		if (m_autoComputeBounds)
-			glColor3f(0.0f, 0.0f, 1.0f);
-		glVertex3d(m_position.x + bound.v, m_position.y + bound.w, m_position.z);
-		glVertex3d(m_position.x + bound.t, m_position.y + bound.w, m_position.z); 
-		glEnd();
-		glEnable(GL_DEPTH_TEST);
+bool LKLayer::isCulled(void) const
+{
+	if (m_engine == NULL || !m_engine->cullsLayers())
+		return false;
+	return !m_engine->frustum().intersects(subtreeWorldBounds());
+}
+
+void LKLayer::computeBoundsFromSublayers(void) const
+{
+	m_bounds.set(1000, 1000, -1000, -1000);
+	foreach (LKLayer* l, m_layers){
+		const Coord3d& p = l->position();
+		const Coord4d  b = l->bounds();
+		m_bounds.t = std::min(m_bounds.t, p.x + b.t);
+		m_bounds.u = std::min(m_bounds.u, p.y + b.u);
+		m_bounds.v = std::max(m_bounds.v, p.x + b.v);
+		m_bounds.w = std::max(m_bounds.w, p.y + b.w);
 	}
+	m_dirtyFlags &= ~AUTO_BOUNDS_DIRTY;
+}
+
+void LKLayer::drawDebugBounds(void)
+{
+	glLoadName(0);
+
+	Coord4d bound = bounds();
+	const Coord3d& p = position();
+
+	glDisable(GL_DEPTH_TEST);
+	if (m_autoComputeBounds)
+		glColor3f(1.0f, 0.0f, 0.0f);
+	else
+		glColor3f(0.0f, 1.0f, 1.0f);
+	glBegin(GL_LINE_LOOP);
+	glVertex3d(p.x + bound.t, p.y + bound.u, p.z); 
+	glVertex3d(p.x + bound.v, p.y + bound.u, p.z);
+			
+	if (m_autoComputeBounds)
+		glColor3f(0.0f, 0.0f, 1.0f);
+	glVertex3d(p.x + bound.v, p.y + bound.w, p.z);
+	glVertex3d(p.x + bound.t, p.y + bound.w, p.z); 
+	glEnd();
+	glEnable(GL_DEPTH_TEST);
 }
 
 bool LKLayer::isHidden(void) const
@@ -478,17 +853,17 @@ void LKLayer::convertFromVWorld(Coord2d& c)
 {
 	if (m_superlayer != NULL)
 		m_superlayer->convertFromVWorld(c);
-	c.x = c.x - m_position.x;
-	c.y = c.y - m_position.y;	
+	c.x = c.x - position().x;
+	c.y = c.y - position().y;	
 }
 
 void LKLayer::convertFromVWorld(Coord3d& c)
 {
 	if (m_superlayer != NULL)
 		m_superlayer->convertFromVWorld(c);
-	c.x = c.x + m_position.x;
-	c.y = c.y + m_position.y;	
-	c.z = c.z + m_position.z;
+	c.x = c.x + position().x;
+	c.y = c.y + position().y;	
+	c.z = c.z + position().z;
 }
 
 bool LKLayer::mouseDown(LKEvent* event)
@@ -531,8 +906,50 @@ bool LKLayer::keydown(LKEvent* event)
 	return LK_CONTINUE_EVENT;
 }
 
+bool LKLayer::becomeFirstResponder(void)
+{
+	if (m_engine == NULL)
+		return false;
+	m_engine->setFirstResponder(this);
+	return true;
+}
+
+void LKLayer::resignFirstResponder(void)
+{
+	if (isFirstResponder())
+		m_engine->setFirstResponder(NULL);
+}
+
+bool LKLayer::isFirstResponder(void) const
+{
+	return m_engine != NULL && m_engine->firstResponder() == this;
+}
+
+bool LKLayer::wantsKeyEvents(void) const
+{
+	return m_wantsKeyEvents;
+}
+
+void LKLayer::setWantsKeyEvents(bool v)
+{
+	if (m_wantsKeyEvents == v)
+		return;
+	m_wantsKeyEvents = v;
+	if (m_engine == NULL)
+		return;
+	if (v)
+		m_engine->addKeyListener(this);
+	else
+		m_engine->removeKeyListener(this);
+}
+
 LKAnimator* LKLayer::animator(void)
 {
+    if (m_animator == NULL){
+        m_animator = new LKLinearAnimator(this);
+		if (m_engine != NULL)
+			m_animator->setScheduler(&m_engine->animationScheduler());
+	}
     return m_animator;
 }
 
@@ -21,13 +21,19 @@
 #ifndef LKLayer_h
 #define LKLayer_h
 
+#include "math/Box3.h"
 #include "math/Coord.h"
+#include "math/Matrix4.h"
 #include "LKKey.h"
+#include "LKLayerTable.h"
+#include "LKPool.h"
+#include "LKTransformStore.h"
 #include <vector>
 using std::vector;
 
 
 class LKAnimator;
+class LKEngine;
 
 typedef enum EventType {
     DEV_BUTTON_DOWN          = 1,
@@ -93,13 +99,57 @@ public:
 	LKLayer(Coord3d position, Coord4d bounds);
 	virtual ~LKLayer(void);
 
+	LK_DECLARE_POOLED(LKLayer)
+
     int tag(void) const;
+    /** returns the layer in this subtree with the specified tag. When this
+     *  layer is attached to an engine the layer is found in constant time,
+     *  and checking that it is within this subtree is linear in its depth */
     LKLayer* layerWithTag(const int tag);
 
+    /** returns the engine this layer is attached to, or NULL if the layer
+     *  is not part of an engine's layer tree */
+    LKEngine* engine(void) const;
+    /** returns the handle of this layer in its engine's layer table. The
+     *  handle is null when the layer is not attached to an engine */
+    LKLayerHandle handle(void) const;
+
+    typedef vector<LKLayer*>::const_iterator SublayerIterator;
+
     LKLayer* superlayer(void) const;
+    /** returns a copy of the sublayers of this layer. Traversals should
+     *  prefer the iterator and index accessors below, which do not allocate */
     vector<LKLayer*> sublayers(void) const;    
+    SublayerIterator sublayersBegin(void) const;
+    SublayerIterator sublayersEnd(void) const;
+    int sublayerCount(void) const;
+    LKLayer* sublayerAtIndex(int index) const;
+    /** appends layer to the sublayers of this layer, first removing it
+     *  from its current superlayer */
     void addSublayer(LKLayer* layer);
+    /** removes this layer from its superlayer, keeping the remaining
+     *  siblings in order. Linear in the number of siblings after it */
     void removeFromSuperlayer(void);
+    /** removes this layer from its superlayer in constant time. The last
+     *  sibling takes this layer's place, which changes its drawing and
+     *  hit testing order, so this suits only unordered sublayers */
+    void removeFromSuperlayerUnordered(void);
+    /** removes each of the specified sublayers in a single pass, keeping
+     *  the remaining sublayers in order. Layers that are not sublayers of
+     *  this layer are ignored */
+    void removeSublayers(const vector<LKLayer*>& layers);
+    /** moves count sublayers starting at index to the end of the sublayers
+     *  of superlayer, keeping their order. superlayer must not be within
+     *  the moved subtrees */
+    void moveSublayers(int index, int count, LKLayer* superlayer);
+    /** swaps the sublayers at the two indices */
+    void exchangeSublayersAtIndices(int i, int j);
+    /** moves layer, which must be a sublayer of this layer, to index. The
+     *  sublayers in between shift by one place */
+    void moveSublayerToIndex(LKLayer* layer, int index);
+    /** returns the index of this layer within its superlayer's sublayers,
+     *  or -1 if it has no superlayer */
+    int indexInSuperlayer(void) const;
 
     /** converts a point in local layer coordinates to a point
      * in the coordinate system of a layer */
@@ -110,7 +160,9 @@ public:
 	Coord2d convertPointToLayer(const Coord2d& p);
 
 	/** converts a point from screen coordinates to a point in this
-	 *  layer with at a specified z depth */
+	 *  layer with at a specified z depth. This and the conversions below
+	 *  use the matrices of the layer's engine, so they need no GL context.
+	 *  Detached layers use the current OpenGL matrices instead */
 	Coord3d convertScreenToLayerWithZValue(const Coord2d aPoint, double zValue);
 
 	Coord3d convertLayerToScreen(const Coord3d aPoint);
@@ -123,9 +175,20 @@ public:
     const Coord4d bounds(void) const;
     void setBounds(const Coord4d& bounds);
     void setBounds(const double& t, const double& u, const double& v, const double& w);
+	/** when set, the bounds of this layer enclose the bounds of its
+	 *  sublayers. They are recomputed lazily, only after a sublayer has
+	 *  been moved, resized, added or removed */
 	bool autoComputeBounds(void);
 	void setAutoComputeBounds(bool v);
 
+	/** the axis aligned box, in root layer coordinates, enclosing the
+	 *  bounds rectangle of this layer after its full 3D transform */
+	const Box3d& worldBounds(void) const;
+	/** the axis aligned box, in root layer coordinates, enclosing this
+	 *  layer and all of its sublayers. Cached; after a change only the
+	 *  changed layers and their superlayers are recomputed */
+	const Box3d& subtreeWorldBounds(void) const;
+
     const Coord3d& position(void) const;
     void setPosition(const Coord3d& pos);
     void setPosition(const double& x, const double& y, const double& z);
@@ -155,7 +218,24 @@ public:
 	const double opacity(void) const;
 	void setOpacity(double v);
 
-    /** calls the draw method of this and any sub layers */
+	/** the transform from this layer's coordinate system to its superlayer.
+	 *  Sublayers are placed within this frame. The matrix is cached and only
+	 *  rebuilt after the position, offset, rotation or scale changes */
+	const Matrix4d& localTransform(void) const;
+	/** the transform this layer's contents are drawn with, relative to its
+	 *  superlayer. This is the local transform with the x rotation applied,
+	 *  which (unlike the other rotations) is not inherited by sublayers */
+	const Matrix4d& contentTransform(void) const;
+	/** the transform from this layer's coordinate system to the coordinate
+	 *  system of the root layer. Recomputed lazily when this layer or any
+	 *  of its superlayers has changed since it was last requested */
+	const Matrix4d& worldTransform(void) const;
+	/** the content transform of this layer relative to the root layer */
+	const Matrix4d& worldContentTransform(void) const;
+
+    /** calls the draw method of this and any sub layers. When the layer's
+     *  engine culls layers, subtrees whose bounds lie outside the view are
+     *  not drawn */
 	enum RenderStage {PRE_DRAW, DRAW, DRAW_TRANSPARENT, POST_DRAW};
     void display(long millisecondsPast, RenderStage renderStage=DRAW);
 	void display(void);
@@ -187,30 +267,142 @@ public:
     virtual bool mouseEntered(LKEvent* event);
     virtual bool mouseExited(LKEvent* event);
 	virtual bool scrollWheel(LKEvent* event);
+	/** a key has been pressed. Key events go to the first responder and
+	 *  then to each of its superlayers in turn for as long as they return
+	 *  true */
 	virtual bool keydown(LKEvent* event);
 
+	/** makes this layer the one that receives key events first. Returns
+	 *  false if the layer is not attached to an engine */
+	bool becomeFirstResponder(void);
+	void resignFirstResponder(void);
+	bool isFirstResponder(void) const;
+
+	/** when set, the layer is also sent every key event that the first
+	 *  responder and its superlayers pass on, wherever it is in the tree */
+	bool wantsKeyEvents(void) const;
+	void setWantsKeyEvents(bool v);
+
     LKAnimator* animator(void);
     friend class LKAnimator;
+    friend class LKEngine;
+	friend struct LKLayerPosition;
+	friend struct LKLayerPositionOffset;
+	friend struct LKLayerRotation;
+	friend struct LKLayerScale;
+	friend struct LKLayerOpacity;
 	
 	static const bool debugLayer(void);
 	static void setDebugLayer(bool debug);
 
 private:
+	/** fills in the matrices and viewport that map the contents of this
+	 *  layer to the screen */
+	void screenTransform(Matrix4d& modelview, Matrix4d& projection, int viewport[4]) const;
+
+	/** registers this layer and its sublayers with engine, removing them
+	 *  from any engine they were previously registered with */
+	void setEngine(LKEngine* engine);
+	/** moves the transform components of this layer into the slot of its
+	 *  handle in store, or back into the layer when store is NULL */
+	void setTransformStore(LKTransformStore* store);
+	/** stores each sublayer's index in [from, to) after a reorder */
+	void reindexSublayers(int from, int to);
+	/** clears the superlayer of a layer that has just been taken out of
+	 *  its superlayer's sublayers */
+	void detachFromSuperlayer(void);
+
+	/** marks the local transform of this layer, and the world transforms
+	 *  of it and its sublayers, as needing to be recomputed */
+	void invalidateTransform(void);
+	void invalidateWorldTransform(void);
+	/** marks the bounds of this layer and its superlayers as needing to be
+	 *  recomputed */
+	void invalidateBounds(void);
+	/** queues this layer's box in the engine's pick tree to be refit
+	 *  before the next hit test */
+	void invalidatePickBounds(void);
+	void updateLocalTransform(void) const;
+	void updateWorldTransform(void) const;
+	void updateWorldBounds(void) const;
+
+	/** recomputes m_bounds to enclose the bounds of the sublayers */
+	void computeBoundsFromSublayers(void) const;
+	/** outlines the bounds of this layer. Assumes OpenGL is in the
+	 *  coordinate system of the superlayer */
+	void drawDebugBounds(void);
+	/** returns true if this layer's engine culls layers and the subtree
+	 *  from this layer lies entirely outside its view frustum */
+	bool isCulled(void) const;
+
+	/** the storage of the transform components, which is either this layer
+	 *  or its engine's transform store */
+	Coord3d& positionRef(void);
+	Coord3d& positionOffsetRef(void);
+	Coord3d& rotationRef(void);
+	Coord3d& scaleRef(void);
+	double&  opacityRef(void);
+
+	enum DirtyFlags {
+		LOCAL_TRANSFORM_DIRTY = 1,
+		WORLD_TRANSFORM_DIRTY = 2,
+		BOUNDS_DIRTY          = 4,
+		AUTO_BOUNDS_DIRTY     = 8,
+		PICK_BOUNDS_DIRTY     = 16
+	};
+
     int      m_tag; /** the unique identifier for this layer */
     bool     m_isHidden; /** is the layer hidden from view */
-    Coord4d  m_bounds;
+    mutable Coord4d m_bounds;
 	bool     m_autoComputeBounds;
+	bool     m_wantsKeyEvents;
     Coord3d  m_position;
 	Coord3d  m_positionOffset;
     Coord3d  m_rotation;
     Coord3d  m_scale;
 	double   m_opacity;
     LKLayer* m_superlayer;
+	int      m_indexInSuperlayer; /** the position of this layer within m_superlayer->m_layers */
 	vector<LKLayer*> m_layers;
 	LKAnimator* m_animator;
-
+	LKEngine*   m_engine;
+	LKLayerHandle m_handle;
+	LKTransformStore* m_transformStore; /** where the transform components live, NULL for this layer */
+
+	mutable int      m_dirtyFlags;
+	mutable Matrix4d m_localTransform;
+	mutable Matrix4d m_contentTransform;
+	mutable Matrix4d m_worldTransform;
+	mutable Matrix4d m_worldContentTransform;
+	mutable Box3d    m_worldBounds;
+	mutable Box3d    m_subtreeWorldBounds;
 };
 
 
+inline Coord3d& LKLayer::positionRef(void)
+{
+	return m_transformStore ? m_transformStore->position(m_handle.index) : m_position;
+}
+
+inline Coord3d& LKLayer::positionOffsetRef(void)
+{
+	return m_transformStore ? m_transformStore->positionOffset(m_handle.index) : m_positionOffset;
+}
+
+inline Coord3d& LKLayer::rotationRef(void)
+{
+	return m_transformStore ? m_transformStore->rotation(m_handle.index) : m_rotation;
+}
+
+inline Coord3d& LKLayer::scaleRef(void)
+{
+	return m_transformStore ? m_transformStore->scale(m_handle.index) : m_scale;
+}
+
+inline double& LKLayer::opacityRef(void)
+{
+	return m_transformStore ? m_transformStore->opacity(m_handle.index) : m_opacity;
+}
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,426 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ */
+#include "LKLayerBVH.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+/** the amount leaf boxes are enlarged by, so that small movements of a
+ *  layer do not move it within the tree */
+static const double g_leafMargin = 0.1;
+
+
+static Box3d enlarge(const Box3d& b)
+{
+	Coord3d margin(g_leafMargin, g_leafMargin, g_leafMargin);
+	return Box3d(b.min - margin, b.max + margin);
+}
+
+static Box3d combine(const Box3d& a, const Box3d& b)
+{
+	Box3d r = a;
+	r.extend(b);
+	return r;
+}
+
+static bool encloses(const Box3d& outer, const Box3d& inner)
+{
+	return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z
+		&& outer.max.x >= inner.max.x && outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+}
+
+/** the cost of testing a box, proportional to its surface area */
+static double cost(const Box3d& b)
+{
+	Coord3d s = b.size();
+	return s.x * s.y + s.y * s.z + s.z * s.x;
+}
+
+static bool rayCrossesBox(const Coord3d& origin, const Coord3d& direction, const Box3d& b)
+{
+	double tmin = 0;
+	double tmax = std::numeric_limits<double>::max();
+	const double o[3]  = {origin.x, origin.y, origin.z};
+	const double d[3]  = {direction.x, direction.y, direction.z};
+	const double lo[3] = {b.min.x, b.min.y, b.min.z};
+	const double hi[3] = {b.max.x, b.max.y, b.max.z};
+
+	for (int i = 0; i < 3; i++){
+		if (fabs(d[i]) < 1e-12){
+			if (o[i] < lo[i] || o[i] > hi[i])
+				return false;
+			continue;
+		}
+		double t1 = (lo[i] - o[i]) / d[i];
+		double t2 = (hi[i] - o[i]) / d[i];
+		if (t1 > t2)
+			std::swap(t1, t2);
+		tmin = std::max(tmin, t1);
+		tmax = std::min(tmax, t2);
+		if (tmin > tmax)
+			return false;
+	}
+	return true;
+}
+
+
+LKLayerBVH::LKLayerBVH(void)
+	: m_root(-1)
+	, m_freeList(-1)
+	, m_leafCount(0)
+{
+}
+
+int LKLayerBVH::insert(LKLayer* layer, const Box3d& box)
+{
+	int leaf = allocateNode();
+	Node& node  = m_nodes[leaf];
+	node.box    = enlarge(box);
+	node.layer  = layer;
+	node.height = 0;
+	insertLeaf(leaf);
+	m_leafCount++;
+	return leaf;
+}
+
+void LKLayerBVH::remove(int leaf)
+{
+	removeLeaf(leaf);
+	freeNode(leaf);
+	m_leafCount--;
+}
+
+bool LKLayerBVH::update(int leaf, const Box3d& box)
+{
+	if (encloses(m_nodes[leaf].box, box))
+		return false;
+
+	removeLeaf(leaf);
+	Node& node = m_nodes[leaf];
+	node.box   = enlarge(box);
+	insertLeaf(leaf);
+	return true;
+}
+
+LKLayer* LKLayerBVH::layer(int leaf) const
+{
+	return m_nodes[leaf].layer;
+}
+
+void LKLayerBVH::raycast(const Coord3d& origin, const Coord3d& direction, std::vector<LKLayer*>& result) const
+{
+	if (m_root < 0)
+		return;
+
+	std::vector<int> stack;
+	stack.push_back(m_root);
+	while (!stack.empty()){
+		const Node& node = m_nodes[stack.back()];
+		stack.pop_back();
+		if (!rayCrossesBox(origin, direction, node.box))
+			continue;
+		if (node.isLeaf()){
+			result.push_back(node.layer);
+		} else {
+			stack.push_back(node.child1);
+			stack.push_back(node.child2);
+		}
+	}
+}
+
+void LKLayerBVH::raycast(const Coord3d* origins, const Coord3d* directions, int count, std::vector<LKLayer*>* results) const
+{
+	if (m_root < 0 || count <= 0)
+		return;
+
+	std::vector<int> activeRays;
+	activeRays.reserve(count * 4);
+	for (int i = 0; i < count; i++)
+		activeRays.push_back(i);
+
+	// each entry on the stack is a node and the range of rays in
+	// activeRays that crossed its parent
+	std::vector<RayRange> stack;
+	RayRange root = {m_root, 0, count};
+	stack.push_back(root);
+	while (!stack.empty()){
+		RayRange entry = stack.back();
+		stack.pop_back();
+		const Node& node = m_nodes[entry.node];
+
+		// the rays that cross this node are appended as a new range
+		int begin = static_cast<int>(activeRays.size());
+		for (int i = entry.begin; i < entry.end; i++){
+			int ray = activeRays[i];
+			if (rayCrossesBox(origins[ray], directions[ray], node.box))
+				activeRays.push_back(ray);
+		}
+		int end = static_cast<int>(activeRays.size());
+		if (begin == end)
+			continue;
+
+		if (node.isLeaf()){
+			for (int i = begin; i < end; i++)
+				results[activeRays[i]].push_back(node.layer);
+		} else {
+			RayRange child1 = {node.child1, begin, end};
+			RayRange child2 = {node.child2, begin, end};
+			stack.push_back(child1);
+			stack.push_back(child2);
+		}
+	}
+}
+
+int LKLayerBVH::leafCount(void) const
+{
+	return m_leafCount;
+}
+
+int LKLayerBVH::height(void) const
+{
+	return m_root < 0 ? 0 : m_nodes[m_root].height;
+}
+
+int LKLayerBVH::allocateNode(void)
+{
+	int index;
+	if (m_freeList >= 0){
+		index      = m_freeList;
+		m_freeList = m_nodes[index].parent;
+	} else {
+		index = static_cast<int>(m_nodes.size());
+		m_nodes.push_back(Node());
+	}
+
+	Node& node  = m_nodes[index];
+	node.layer  = NULL;
+	node.parent = -1;
+	node.child1 = -1;
+	node.child2 = -1;
+	node.height = 0;
+	return index;
+}
+
+void LKLayerBVH::freeNode(int index)
+{
+	Node& node  = m_nodes[index];
+	node.layer  = NULL;
+	node.parent = m_freeList;
+	node.height = -1;
+	m_freeList  = index;
+}
+
+void LKLayerBVH::insertLeaf(int leaf)
+{
+	if (m_root < 0){
+		m_root = leaf;
+		m_nodes[leaf].parent = -1;
+		return;
+	}
+
+	// descend towards the sibling that would grow the tree the least
+	const Box3d leafBox = m_nodes[leaf].box;
+	int index = m_root;
+	while (!m_nodes[index].isLeaf()){
+		const Node& node = m_nodes[index];
+		double area         = cost(node.box);
+		double combinedArea = cost(combine(node.box, leafBox));
+
+		// the cost of pairing the leaf with this node, and the cost every
+		// ancestor pays for descending further
+		double costHere    = 2 * combinedArea;
+		double inheritance = 2 * (combinedArea - area);
+
+		const Node& child1 = m_nodes[node.child1];
+		const Node& child2 = m_nodes[node.child2];
+		double cost1 = cost(combine(leafBox, child1.box)) + inheritance;
+		double cost2 = cost(combine(leafBox, child2.box)) + inheritance;
+		if (!child1.isLeaf())
+			cost1 -= cost(child1.box);
+		if (!child2.isLeaf())
+			cost2 -= cost(child2.box);
+
+		if (costHere < cost1 && costHere < cost2)
+			break;
+		index = cost1 < cost2 ? node.child1 : node.child2;
+	}
+
+	// pair the leaf with the sibling under a new parent
+	int sibling   = index;
+	int oldParent = m_nodes[sibling].parent;
+	int newParent = allocateNode();
+	Node& parent  = m_nodes[newParent];
+	parent.parent = oldParent;
+	parent.box    = combine(leafBox, m_nodes[sibling].box);
+	parent.height = m_nodes[sibling].height + 1;
+	parent.child1 = sibling;
+	parent.child2 = leaf;
+
+	if (oldParent >= 0){
+		if (m_nodes[oldParent].child1 == sibling)
+			m_nodes[oldParent].child1 = newParent;
+		else
+			m_nodes[oldParent].child2 = newParent;
+	} else {
+		m_root = newParent;
+	}
+	m_nodes[sibling].parent = newParent;
+	m_nodes[leaf].parent    = newParent;
+
+	refitFrom(newParent);
+}
+
+void LKLayerBVH::removeLeaf(int leaf)
+{
+	if (leaf == m_root){
+		m_root = -1;
+		return;
+	}
+
+	int parent      = m_nodes[leaf].parent;
+	int grandParent = m_nodes[parent].parent;
+	int sibling     = m_nodes[parent].child1 == leaf ? m_nodes[parent].child2 : m_nodes[parent].child1;
+
+	// the sibling takes the place of the parent
+	if (grandParent >= 0){
+		if (m_nodes[grandParent].child1 == parent)
+			m_nodes[grandParent].child1 = sibling;
+		else
+			m_nodes[grandParent].child2 = sibling;
+		m_nodes[sibling].parent = grandParent;
+		freeNode(parent);
+		refitFrom(grandParent);
+	} else {
+		m_root = sibling;
+		m_nodes[sibling].parent = -1;
+		freeNode(parent);
+	}
+}
+
+void LKLayerBVH::refitFrom(int index)
+{
+	while (index >= 0){
+		index = balance(index);
+
+		Node& node = m_nodes[index];
+		const Node& child1 = m_nodes[node.child1];
+		const Node& child2 = m_nodes[node.child2];
+		node.height = 1 + std::max(child1.height, child2.height);
+		node.box    = combine(child1.box, child2.box);
+
+		index = node.parent;
+	}
+}
+
+int LKLayerBVH::balance(int iA)
+{
+	Node& A = m_nodes[iA];
+	if (A.isLeaf() || A.height < 2)
+		return iA;
+
+	int iB = A.child1;
+	int iC = A.child2;
+	Node& B = m_nodes[iB];
+	Node& C = m_nodes[iC];
+
+	int balance = C.height - B.height;
+
+	// rotate C up
+	if (balance > 1){
+		int iF = C.child1;
+		int iG = C.child2;
+		Node& F = m_nodes[iF];
+		Node& G = m_nodes[iG];
+
+		C.child1 = iA;
+		C.parent = A.parent;
+		A.parent = iC;
+		if (C.parent >= 0){
+			if (m_nodes[C.parent].child1 == iA)
+				m_nodes[C.parent].child1 = iC;
+			else
+				m_nodes[C.parent].child2 = iC;
+		} else {
+			m_root = iC;
+		}
+
+		if (F.height > G.height){
+			C.child2 = iF;
+			A.child2 = iG;
+			G.parent = iA;
+			A.box    = combine(B.box, G.box);
+			C.box    = combine(A.box, F.box);
+			A.height = 1 + std::max(B.height, G.height);
+			C.height = 1 + std::max(A.height, F.height);
+		} else {
+			C.child2 = iG;
+			A.child2 = iF;
+			F.parent = iA;
+			A.box    = combine(B.box, F.box);
+			C.box    = combine(A.box, G.box);
+			A.height = 1 + std::max(B.height, F.height);
+			C.height = 1 + std::max(A.height, G.height);
+		}
+		return iC;
+	}
+
+	// rotate B up
+	if (balance < -1){
+		int iD = B.child1;
+		int iE = B.child2;
+		Node& D = m_nodes[iD];
+		Node& E = m_nodes[iE];
+
+		B.child1 = iA;
+		B.parent = A.parent;
+		A.parent = iB;
+		if (B.parent >= 0){
+			if (m_nodes[B.parent].child1 == iA)
+				m_nodes[B.parent].child1 = iB;
+			else
+				m_nodes[B.parent].child2 = iB;
+		} else {
+			m_root = iB;
+		}
+
+		if (D.height > E.height){
+			B.child2 = iD;
+			A.child1 = iE;
+			E.parent = iA;
+			A.box    = combine(C.box, E.box);
+			B.box    = combine(A.box, D.box);
+			A.height = 1 + std::max(C.height, E.height);
+			B.height = 1 + std::max(A.height, D.height);
+		} else {
+			B.child2 = iE;
+			A.child1 = iD;
+			D.parent = iA;
+			A.box    = combine(C.box, D.box);
+			B.box    = combine(A.box, E.box);
+			A.height = 1 + std::max(C.height, D.height);
+			B.height = 1 + std::max(A.height, E.height);
+		}
+		return iB;
+	}
+
+	return iA;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ */
+#ifndef LKLayerBVH_h
+#define LKLayerBVH_h
+
+#include <vector>
+#include "math/Box3.h"
+#include "math/Coord.h"
+
+
+class LKLayer;
+
+
+/** a bounding volume hierarchy over the world space boxes of layers, used
+ *  to find the layers under a point without visiting the whole tree. The
+ *  tree is updated incrementally: leaves are stored with a slightly
+ *  enlarged box, and a leaf is only moved within the tree once its layer
+ *  leaves that box. Insertions keep the tree height balanced, so queries
+ *  are logarithmic in the number of layers */
+class LKLayerBVH {
+public:
+	LKLayerBVH(void);
+
+	/** adds a leaf for layer and returns its id */
+	int insert(LKLayer* layer, const Box3d& box);
+	void remove(int leaf);
+	/** sets the box of leaf. Returns true if the leaf had to be moved
+	 *  within the tree */
+	bool update(int leaf, const Box3d& box);
+
+	LKLayer* layer(int leaf) const;
+
+	/** appends to result the layers whose boxes are crossed by the ray
+	 *  origin + t * direction, t >= 0. The boxes are tested with the
+	 *  enlargement, so callers should make their own exact test of the
+	 *  layers returned */
+	void raycast(const Coord3d& origin, const Coord3d& direction, std::vector<LKLayer*>& result) const;
+	/** casts count rays in one walk of the tree, appending the layers
+	 *  crossed by ray i to results[i]. Each node is visited once, with
+	 *  the rays that reached it, so the cost grows with the size of the
+	 *  tree plus the number of rays rather than their product */
+	void raycast(const Coord3d* origins, const Coord3d* directions, int count, std::vector<LKLayer*>* results) const;
+
+	int leafCount(void) const;
+	/** the height of the tree; 0 for a tree of one leaf */
+	int height(void) const;
+
+private:
+	struct Node {
+		Box3d    box;
+		LKLayer* layer;
+		int      parent; /** the next free node while on the free list */
+		int      child1;
+		int      child2;
+		int      height; /** 0 for leaves, -1 for free nodes */
+
+		bool isLeaf(void) const
+		{
+			return child1 < 0;
+		}
+	};
+
+	/** a node, and the range of the rays in a batch raycast that reach
+	 *  it */
+	struct RayRange {
+		int node;
+		int begin;
+		int end;
+	};
+
+	int  allocateNode(void);
+	void freeNode(int node);
+	void insertLeaf(int leaf);
+	void removeLeaf(int leaf);
+	/** recomputes the boxes and heights from node up to the root,
+	 *  rebalancing on the way */
+	void refitFrom(int node);
+	/** rotates the subtree at node if it is unbalanced. Returns the index
+	 *  of the new subtree root */
+	int  balance(int node);
+
+	std::vector<Node> m_nodes;
+	int m_root;
+	int m_freeList;
+	int m_leafCount;
+};
+
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ */
+#include "LKLayerTable.h"
+
+#include "LKLayer.h"
+
+
+LKLayerTable::LKLayerTable(void)
+	: m_freeList(-1)
+	, m_size(0)
+{
+}
+
+LKLayerHandle LKLayerTable::insert(LKLayer* layer)
+{
+	int index;
+	if (m_freeList >= 0){
+		index      = m_freeList;
+		m_freeList = m_slots[index].nextFree;
+	} else {
+		Slot slot = {NULL, 1, -1};
+		index = static_cast<int>(m_slots.size());
+		m_slots.push_back(slot);
+	}
+
+	Slot& slot    = m_slots[index];
+	slot.layer    = layer;
+	slot.nextFree = -1;
+	m_tagIndex[layer->tag()] = index;
+	m_size++;
+
+	return LKLayerHandle(index, slot.generation);
+}
+
+void LKLayerTable::remove(const LKLayerHandle& handle)
+{
+	if (!isValid(handle))
+		return;
+
+	Slot& slot = m_slots[handle.index];
+	m_tagIndex.erase(slot.layer->tag());
+	slot.layer    = NULL;
+	slot.generation++;
+	slot.nextFree = m_freeList;
+	m_freeList    = handle.index;
+	m_size--;
+}
+
+LKLayer* LKLayerTable::layer(const LKLayerHandle& handle) const
+{
+	if (!isValid(handle))
+		return NULL;
+	return m_slots[handle.index].layer;
+}
+
+LKLayer* LKLayerTable::layerWithTag(const int tag) const
+{
+	boost::unordered_map<int, int>::const_iterator found = m_tagIndex.find(tag);
+	if (found == m_tagIndex.end())
+		return NULL;
+	return m_slots[found->second].layer;
+}
+
+LKLayer* LKLayerTable::layerAtIndex(int index) const
+{
+	return m_slots[index].layer;
+}
+
+bool LKLayerTable::isValid(const LKLayerHandle& handle) const
+{
+	return handle.index >= 0
+		&& handle.index < static_cast<int>(m_slots.size())
+		&& m_slots[handle.index].generation == handle.generation
+		&& m_slots[handle.index].layer != NULL;
+}
+
+int LKLayerTable::size(void) const
+{
+	return m_size;
+}
+
+int LKLayerTable::capacity(void) const
+{
+	return static_cast<int>(m_slots.size());
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ */
+#ifndef LKLayerTable_h
+#define LKLayerTable_h
+
+#include <boost/unordered_map.hpp>
+#include <vector>
+
+
+class LKLayer;
+
+
+/** a weak reference to a layer registered with an LKEngine. A handle
+ *  stays safe to resolve after the layer has been removed from the
+ *  engine; it then resolves to NULL rather than to whichever layer
+ *  reused its slot */
+struct LKLayerHandle {
+	int      index;
+	unsigned generation;
+
+	LKLayerHandle()
+		: index(-1)
+		, generation(0)
+	{
+	}
+
+	LKLayerHandle(int index, unsigned generation)
+		: index(index)
+		, generation(generation)
+	{
+	}
+
+	bool isNull(void) const
+	{
+		return index < 0;
+	}
+
+	bool operator==(const LKLayerHandle& h) const
+	{
+		return index == h.index && generation == h.generation;
+	}
+
+	bool operator!=(const LKLayerHandle& h) const
+	{
+		return !(*this == h);
+	}
+
+	/** orders handles by slot, so that they can be kept in sorted
+	 *  containers */
+	bool operator<(const LKLayerHandle& h) const
+	{
+		return index < h.index || (index == h.index && generation < h.generation);
+	}
+};
+
+
+/** the table of layers attached to an engine. Slots freed by removed
+ *  layers are reused, and each reuse bumps the slot's generation so that
+ *  old handles to the slot no longer resolve. Lookups by handle and by
+ *  tag are constant time */
+class LKLayerTable {
+public:
+	LKLayerTable(void);
+
+	LKLayerHandle insert(LKLayer* layer);
+	void remove(const LKLayerHandle& handle);
+
+	/** returns the layer referred to by handle, or NULL if the handle
+	 *  is stale */
+	LKLayer* layer(const LKLayerHandle& handle) const;
+	LKLayer* layerWithTag(const int tag) const;
+	/** returns the layer in slot index, or NULL if the slot is free */
+	LKLayer* layerAtIndex(int index) const;
+	bool isValid(const LKLayerHandle& handle) const;
+
+	/** returns the number of layers in the table */
+	int size(void) const;
+	/** returns the number of slots in the table, including free slots.
+	 *  Handle indices are always less than this value */
+	int capacity(void) const;
+
+private:
+	struct Slot {
+		LKLayer* layer;
+		unsigned generation;
+		int      nextFree;
+	};
+
+	std::vector<Slot> m_slots;
+	int m_freeList;
+	int m_size;
+	boost::unordered_map<int, int> m_tagIndex;
+};
+
+
+#endif
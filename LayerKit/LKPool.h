@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ */
+#ifndef LKPool_h
+#define LKPool_h
+
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+
+
+/** a fixed size block allocator for objects of type T. Blocks are carved
+ *  out of chunks of BlocksPerChunk objects, and freed blocks are kept on
+ *  a free list to be handed out again, so steady state allocation never
+ *  reaches the global heap. Chunks are only returned when the pool is
+ *  destroyed. Allocation and deallocation take a lock, as objects such
+ *  as layers may be created and freed on any thread */
+template <typename T, int BlocksPerChunk = 64>
+class LKPool {
+public:
+	LKPool(void)
+		: m_freeList(NULL)
+		, m_allocated(0)
+	{
+	}
+
+	~LKPool(void)
+	{
+		for (size_t i = 0; i < m_chunks.size(); i++)
+			::operator delete(m_chunks[i]);
+	}
+
+	/** returns uninitialised storage for one T */
+	void* allocate(void)
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		if (m_freeList == NULL)
+			addChunk();
+		Block* block = m_freeList;
+		m_freeList   = block->next;
+		m_allocated++;
+		return block;
+	}
+
+	/** returns storage obtained from allocate() to the pool */
+	void deallocate(void* p)
+	{
+		if (p == NULL)
+			return;
+		boost::mutex::scoped_lock lock(m_mutex);
+		Block* block = static_cast<Block*>(p);
+		block->next  = m_freeList;
+		m_freeList   = block;
+		m_allocated--;
+	}
+
+	/** returns the number of blocks currently handed out */
+	int allocatedCount(void) const
+	{
+		return m_allocated;
+	}
+
+	/** returns the number of blocks the pool holds, used or free */
+	int capacity(void) const
+	{
+		return static_cast<int>(m_chunks.size()) * BlocksPerChunk;
+	}
+
+	/** returns the pool shared by all objects of type T. It is never
+	 *  destroyed, so objects may safely be freed during static
+	 *  destruction */
+	static LKPool& shared(void)
+	{
+		static LKPool* pool = new LKPool;
+		return *pool;
+	}
+
+private:
+	union Block {
+		Block* next;
+		char   storage[sizeof(T)];
+		// members only present to align storage
+		double      d;
+		long double ld;
+		void*       p;
+	};
+
+	void addChunk(void)
+	{
+		Block* chunk = static_cast<Block*>(::operator new(sizeof(Block) * BlocksPerChunk));
+		m_chunks.push_back(chunk);
+		for (int i = BlocksPerChunk - 1; i >= 0; i--){
+			chunk[i].next = m_freeList;
+			m_freeList    = &chunk[i];
+		}
+	}
+
+	// pools are not copyable
+	LKPool(const LKPool&);
+	LKPool& operator=(const LKPool&);
+
+	boost::mutex        m_mutex;
+	std::vector<Block*> m_chunks;
+	Block* m_freeList;
+	int    m_allocated;
+};
+
+
+/** declares class specific operator new and delete that allocate
+ *  objects of exactly type T from LKPool<T>::shared(). Subclasses of
+ *  a different size fall back to the global heap, so the class must
+ *  have a virtual destructor if it is deleted through a base pointer */
+#define LK_DECLARE_POOLED(T) \
+	static void* operator new(size_t size) \
+	{ \
+		if (size != sizeof(T)) \
+			return ::operator new(size); \
+		return LKPool<T>::shared().allocate(); \
+	} \
+	static void operator delete(void* p, size_t size) \
+	{ \
+		if (size != sizeof(T)) \
+			::operator delete(p); \
+		else \
+			LKPool<T>::shared().deallocate(p); \
+	}
+
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ */
+#include "LKTransformStore.h"
+
+#include <algorithm>
+
+
+LKTransformStore::LKTransformStore(void)
+{
+}
+
+void LKTransformStore::reserveSlots(int n)
+{
+	if (n <= slotCount())
+		return;
+
+	// grow geometrically so that registering layers one at a time
+	// does not copy the arrays every time
+	size_t size = std::max(size_t(n), m_positions.size() * 2);
+	m_positions.resize(size);
+	m_positionOffsets.resize(size);
+	m_rotations.resize(size);
+	m_scales.resize(size, Coord3d(1, 1, 1));
+	m_opacities.resize(size, 1.0);
+}
+
+int LKTransformStore::slotCount(void) const
+{
+	return static_cast<int>(m_positions.size());
+}
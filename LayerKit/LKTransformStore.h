@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ */
+#ifndef LKTransformStore_h
+#define LKTransformStore_h
+
+#include <vector>
+#include "math/Coord.h"
+
+
+/** contiguous storage for the transform and opacity components of the
+ *  layers attached to an engine. Each component lives in its own array,
+ *  indexed by the slot of the layer's LKLayerHandle, so that batch
+ *  updates over many layers stream through memory rather than visiting
+ *  every layer object.
+ *
+ *  Code that writes to the arrays directly must then call
+ *  LKEngine::transformStoreDidChange() so that the cached matrices and
+ *  bounds of the affected layers are rebuilt. Free slots hold stale
+ *  values and may be written to harmlessly */
+class LKTransformStore {
+public:
+	LKTransformStore(void);
+
+	/** grows the arrays so that they hold at least n slots. Growing may
+	 *  move the arrays, invalidating pointers and references into them */
+	void reserveSlots(int n);
+	int  slotCount(void) const;
+
+	Coord3d* positions(void)       { return &m_positions[0]; }
+	Coord3d* positionOffsets(void) { return &m_positionOffsets[0]; }
+	Coord3d* rotations(void)       { return &m_rotations[0]; }
+	Coord3d* scales(void)          { return &m_scales[0]; }
+	double*  opacities(void)       { return &m_opacities[0]; }
+
+	Coord3d& position(int slot)       { return m_positions[slot]; }
+	Coord3d& positionOffset(int slot) { return m_positionOffsets[slot]; }
+	Coord3d& rotation(int slot)       { return m_rotations[slot]; }
+	Coord3d& scale(int slot)          { return m_scales[slot]; }
+	double&  opacity(int slot)        { return m_opacities[slot]; }
+
+	const Coord3d& position(int slot) const       { return m_positions[slot]; }
+	const Coord3d& positionOffset(int slot) const { return m_positionOffsets[slot]; }
+	const Coord3d& rotation(int slot) const       { return m_rotations[slot]; }
+	const Coord3d& scale(int slot) const          { return m_scales[slot]; }
+	const double&  opacity(int slot) const        { return m_opacities[slot]; }
+
+private:
+	std::vector<Coord3d> m_positions;
+	std::vector<Coord3d> m_positionOffsets;
+	std::vector<Coord3d> m_rotations;
+	std::vector<Coord3d> m_scales;
+	std::vector<double>  m_opacities;
+};
+
+
+#endif
@@ -30,7 +30,9 @@ struct LKEvent;
 
 
 /** creates a vector of LKEvents by polling input from
- *  the ManyMouse library */
+ *  the ManyMouse library. The events point into static storage that the
+ *  next call overwrites; LKInputThread reads devices off the render
+ *  thread and delivers events by value instead */
 std::vector<LKEvent*> BuildLKEventsFromManyMouseEvents(void);
 
 
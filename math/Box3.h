@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ *
+ */
+
+#ifndef Box3_h
+#define Box3_h
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include "math/Coord.h"
+
+
+// 3-dimensional axis aligned box
+template <class T>
+struct Box3 {
+	Coord3<T> min, max;
+
+	/** constructs an empty box. Extending an empty box by a point gives
+	 *  a box containing only that point */
+	Box3()
+		: min( std::numeric_limits<T>::max(),  std::numeric_limits<T>::max(),  std::numeric_limits<T>::max())
+		, max(-std::numeric_limits<T>::max(), -std::numeric_limits<T>::max(), -std::numeric_limits<T>::max())
+	{
+	}
+
+	Box3(const Coord3<T>& min, const Coord3<T>& max)
+		: min(min)
+		, max(max)
+	{
+	}
+
+	bool isEmpty(void) const
+	{
+		return min.x > max.x || min.y > max.y || min.z > max.z;
+	}
+
+	void setEmpty(void)
+	{
+		*this = Box3<T>();
+	}
+
+	Box3& extend(const Coord3<T>& p)
+	{
+		min.set(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+		max.set(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+		return *this;
+	}
+
+	Box3& extend(const Box3<T>& b)
+	{
+		if (b.isEmpty())
+			return *this;
+		min.set(std::min(min.x, b.min.x), std::min(min.y, b.min.y), std::min(min.z, b.min.z));
+		max.set(std::max(max.x, b.max.x), std::max(max.y, b.max.y), std::max(max.z, b.max.z));
+		return *this;
+	}
+
+	bool contains(const Coord3<T>& p) const
+	{
+		return p.x >= min.x && p.x <= max.x
+			&& p.y >= min.y && p.y <= max.y
+			&& p.z >= min.z && p.z <= max.z;
+	}
+
+	bool intersects(const Box3<T>& b) const
+	{
+		return !(b.min.x > max.x || b.max.x < min.x
+			  || b.min.y > max.y || b.max.y < min.y
+			  || b.min.z > max.z || b.max.z < min.z);
+	}
+
+	Coord3<T> center(void) const
+	{
+		return (min + max) * 0.5;
+	}
+
+	Coord3<T> size(void) const
+	{
+		return max - min;
+	}
+};
+
+template <class T>
+std::ostream& operator<<( std::ostream& os, const Box3<T>& b ){
+	os << b.min << " " << b.max;
+	return os;
+}
+
+typedef Box3<float>  Box3f;
+typedef Box3<double> Box3d;
+
+
+#endif
@@ -350,6 +350,14 @@ struct Coord3 {
 		y = y * malpha + alpha * t1.y;
 		z = z * malpha + alpha * t1.z;
 	}
+
+	/** returns (1 - alpha) * this + alpha * t1 */
+	Coord3 lerp(const Coord3<T>& t1, double alpha) const
+	{
+		return Coord3<T>(x + (t1.x - x) * alpha,
+						 y + (t1.y - y) * alpha,
+						 z + (t1.z - z) * alpha);
+	}
 };
 
 template <class T>
@@ -407,6 +415,16 @@ struct Coord4 {
         return *this;
 	}
     
+	Coord4 operator+(const Coord4<T>& m) const
+	{
+        return Coord4<T>(t + m.t, u + m.u, v + m.v, w + m.w);
+	}
+
+	Coord4 operator-(const Coord4<T>& m) const
+	{
+        return Coord4<T>(t - m.t, u - m.u, v - m.v, w - m.w);
+	}
+
 	Coord4 operator*(const Coord4<T>& m)
 	{
         return Coord4<T>(t * m.t, u * m.u, v * m.v, w * m.w);
@@ -434,8 +452,27 @@ struct Coord4 {
         this->w = w;
     }
 
+	double dot(const Coord4<T>& m) const
+	{
+		return t * m.t + u * m.u + v * m.v + w * m.w;
+	}
+
+	/** returns (1 - alpha) * this + alpha * t1 */
+	Coord4 lerp(const Coord4<T>& t1, double alpha) const
+	{
+		return Coord4<T>(t + (t1.t - t) * alpha,
+						 u + (t1.u - u) * alpha,
+						 v + (t1.v - v) * alpha,
+						 w + (t1.w - w) * alpha);
+	}
 };
 
+// defining LK_USE_SIMD replaces Coord3f, Coord4f and (with AVX) Coord3d
+// with vectorised specializations. See CoordSIMD.h
+#ifdef LK_USE_SIMD
+#include "math/CoordSIMD.h"
+#endif
+
 template <class T>
 bool contains(const Coord4<T>& r, const Coord<T>& p)
 {
@@ -0,0 +1,563 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ *
+ */
+
+/* SSE and AVX specializations of Coord3<float>, Coord4<float> and
+ * Coord3<double>. This header is included by Coord.h when LK_USE_SIMD is
+ * defined and should not be included directly.
+ *
+ * The specializations keep the member names and operator set of the
+ * generic templates, so code using them compiles unchanged. Coord3f and
+ * Coord3d gain a fourth padding lane, which is always kept at zero, so
+ * sizeof(Coord3f) is 16 and sizeof(Coord3d) is 32. Loads and stores are
+ * unaligned, so the types may be kept in std::vector and in heap objects
+ * without any special allocator. */
+
+#ifndef CoordSIMD_h
+#define CoordSIMD_h
+
+#ifndef Coord_h
+#error "CoordSIMD.h must be included through math/Coord.h"
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LK_COORD_SSE 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX__)
+#define LK_COORD_AVX 1
+#include <immintrin.h>
+#endif
+
+
+#ifdef LK_COORD_SSE
+
+// 3-dimensional float coordinates, one SSE register wide
+template <>
+struct Coord3<float> {
+	float x, y, z;
+	float pad; /** unused fourth lane, always zero */
+
+	Coord3()
+		: x(0), y(0), z(0), pad(0)
+	{
+	}
+
+	Coord3(float x, float y, float z)
+		: x(x), y(y), z(z), pad(0)
+	{
+	}
+
+	Coord3(const Coord<float>& orig)
+		: x(orig.x), y(orig.y), z(0), pad(0)
+	{
+	}
+
+	Coord3(const Coord3<float>& orig)
+	{
+		store(orig.load());
+	}
+
+	void set(const Coord3<float>& t)
+	{
+		store(t.load());
+	}
+
+	void set(const float& x, const float& y, const float& z)
+	{
+		this->x = x;
+		this->y = y;
+		this->z = z;
+	}
+
+	int operator==(const Coord3<float>& t) const
+	{
+		return (_mm_movemask_ps(_mm_cmpeq_ps(load(), t.load())) & 7) == 7;
+	}
+
+	int operator!=(const Coord3<float>& t) const
+	{
+		return !(*this == t);
+	}
+
+	Coord3& operator=(const Coord3<float>& orig)
+	{
+		store(orig.load());
+		return *this;
+	}
+
+	Coord3 operator-(const Coord3<float>& c) const
+	{
+		return Coord3<float>(_mm_sub_ps(load(), c.load()));
+	}
+
+	Coord3 operator+(const Coord3<float>& c) const
+	{
+		return Coord3<float>(_mm_add_ps(load(), c.load()));
+	}
+
+	Coord3& operator+=(const Coord3<float>& c)
+	{
+		store(_mm_add_ps(load(), c.load()));
+		return *this;
+	}
+
+	Coord3 operator*(const double m) const
+	{
+		return Coord3<float>(_mm_mul_ps(load(), _mm_set1_ps(float(m))));
+	}
+
+	Coord3 operator*(const Coord3<float>& m) const
+	{
+		return Coord3<float>(_mm_mul_ps(load(), m.load()));
+	}
+
+	Coord3& operator*=(const float& m)
+	{
+		store(_mm_mul_ps(load(), _mm_set1_ps(m)));
+		return *this;
+	}
+
+	Coord3& operator*=(const Coord3<float>& m)
+	{
+		store(_mm_mul_ps(load(), m.load()));
+		return *this;
+	}
+
+	Coord3 operator/(const double m) const
+	{
+		return Coord3<float>(_mm_div_ps(load(), _mm_set1_ps(float(m))));
+	}
+
+	Coord3 operator/(const Coord3<float>& m) const
+	{
+		return Coord3<float>(maskPad(_mm_div_ps(load(), m.load())));
+	}
+
+	Coord3 operator/=(const float& d)
+	{
+		store(_mm_div_ps(load(), _mm_set1_ps(d)));
+		return *this;
+	}
+
+	Coord3& operator/=(const Coord3<float>& m)
+	{
+		store(maskPad(_mm_div_ps(load(), m.load())));
+		return *this;
+	}
+
+	double len(void) const
+	{
+		return sqrt(dot(*this));
+	}
+
+	Coord3 cross(const Coord3<float>& v) const
+	{
+		__m128 a = load();
+		__m128 b = v.load();
+		__m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+		__m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+		__m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+		return Coord3<float>(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+	}
+
+	Coord3& cross(const Coord3<float>& v1, const Coord3<float>& v2)
+	{
+		*this = v1.cross(v2);
+		return *this;
+	}
+
+	double dot(const Coord3<float>& v) const
+	{
+		__m128 m = _mm_mul_ps(load(), v.load());
+		__m128 s = _mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1)));
+		s = _mm_add_ss(s, _mm_movehl_ps(m, m));
+		return _mm_cvtss_f32(s);
+	}
+
+	double angle(const Coord3<float>& v) const
+	{
+		return acos(dot(v) / (len() + v.len()));
+	}
+
+	Coord3& normalise(void)
+	{
+		store(_mm_div_ps(load(), _mm_set1_ps(float(len()))));
+		return *this;
+	}
+
+	Coord3 unit(void) const
+	{
+		return Coord3<float>(_mm_div_ps(load(), _mm_set1_ps(float(len()))));
+	}
+
+	bool isZero(void) const
+	{
+		return x == 0 && y == 0 && z == 0;
+	}
+
+	/** linearly interpolates between this Coord and Coord t1, such:
+	 *      this = (1 - alpha) * this + alpha * t1 */
+	void interpolate(const Coord3<float>& t1, double alpha)
+	{
+		store(lerp(t1, alpha).load());
+	}
+
+	/** returns (1 - alpha) * this + alpha * t1 */
+	Coord3 lerp(const Coord3<float>& t1, double alpha) const
+	{
+		__m128 a = load();
+		return Coord3<float>(_mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(t1.load(), a), _mm_set1_ps(float(alpha)))));
+	}
+
+private:
+	explicit Coord3(__m128 v)
+	{
+		store(v);
+	}
+
+	__m128 load(void) const
+	{
+		return _mm_loadu_ps(&x);
+	}
+
+	void store(__m128 v)
+	{
+		_mm_storeu_ps(&x, v);
+	}
+
+	static __m128 maskPad(__m128 v)
+	{
+		const __m128 mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+		return _mm_and_ps(v, mask);
+	}
+};
+
+
+// 4-dimensional float coordinates, one SSE register wide
+template <>
+struct Coord4<float> {
+	float t, u, v, w;
+
+	Coord4()
+		: t(0), u(0), v(0), w(0)
+	{ }
+
+	Coord4(float t, float u, float v, float w)
+		: t(t), u(u), v(v), w(w)
+	{ }
+
+	Coord4(const Coord4<float>& orig)
+	{
+		store(orig.load());
+	}
+
+	Coord4& operator=(const Coord4<float>& orig)
+	{
+		store(orig.load());
+		return *this;
+	}
+
+	Coord4 operator+(const Coord4<float>& m) const
+	{
+		return Coord4<float>(_mm_add_ps(load(), m.load()));
+	}
+
+	Coord4 operator-(const Coord4<float>& m) const
+	{
+		return Coord4<float>(_mm_sub_ps(load(), m.load()));
+	}
+
+	Coord4 operator*(const Coord4<float>& m) const
+	{
+		return Coord4<float>(_mm_mul_ps(load(), m.load()));
+	}
+
+	Coord4 operator*(float m) const
+	{
+		return Coord4<float>(_mm_mul_ps(load(), _mm_set1_ps(m)));
+	}
+
+	Coord4& operator*=(float d)
+	{
+		store(_mm_mul_ps(load(), _mm_set1_ps(d)));
+		return *this;
+	}
+
+	void set(const float& t, const float& u, const float& v, const float& w)
+	{
+		this->t = t;
+		this->u = u;
+		this->v = v;
+		this->w = w;
+	}
+
+	double dot(const Coord4<float>& m) const
+	{
+		__m128 p = _mm_mul_ps(load(), m.load());
+		__m128 s = _mm_add_ps(p, _mm_movehl_ps(p, p));
+		s = _mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1)));
+		return _mm_cvtss_f32(s);
+	}
+
+	/** returns (1 - alpha) * this + alpha * t1 */
+	Coord4 lerp(const Coord4<float>& t1, double alpha) const
+	{
+		__m128 a = load();
+		return Coord4<float>(_mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(t1.load(), a), _mm_set1_ps(float(alpha)))));
+	}
+
+private:
+	explicit Coord4(__m128 r)
+	{
+		store(r);
+	}
+
+	__m128 load(void) const
+	{
+		return _mm_loadu_ps(&t);
+	}
+
+	void store(__m128 r)
+	{
+		_mm_storeu_ps(&t, r);
+	}
+};
+
+#endif // LK_COORD_SSE
+
+
+#ifdef LK_COORD_AVX
+
+// 3-dimensional double coordinates, one AVX register wide
+template <>
+struct Coord3<double> {
+	double x, y, z;
+	double pad; /** unused fourth lane, always zero */
+
+	Coord3()
+		: x(0), y(0), z(0), pad(0)
+	{
+	}
+
+	Coord3(double x, double y, double z)
+		: x(x), y(y), z(z), pad(0)
+	{
+	}
+
+	Coord3(const Coord<double>& orig)
+		: x(orig.x), y(orig.y), z(0), pad(0)
+	{
+	}
+
+	Coord3(const Coord3<double>& orig)
+	{
+		store(orig.load());
+	}
+
+	void set(const Coord3<double>& t)
+	{
+		store(t.load());
+	}
+
+	void set(const double& x, const double& y, const double& z)
+	{
+		this->x = x;
+		this->y = y;
+		this->z = z;
+	}
+
+	int operator==(const Coord3<double>& t) const
+	{
+		return (_mm256_movemask_pd(_mm256_cmp_pd(load(), t.load(), _CMP_EQ_OQ)) & 7) == 7;
+	}
+
+	int operator!=(const Coord3<double>& t) const
+	{
+		return !(*this == t);
+	}
+
+	Coord3& operator=(const Coord3<double>& orig)
+	{
+		store(orig.load());
+		return *this;
+	}
+
+	Coord3 operator-(const Coord3<double>& c) const
+	{
+		return Coord3<double>(_mm256_sub_pd(load(), c.load()));
+	}
+
+	Coord3 operator+(const Coord3<double>& c) const
+	{
+		return Coord3<double>(_mm256_add_pd(load(), c.load()));
+	}
+
+	Coord3& operator+=(const Coord3<double>& c)
+	{
+		store(_mm256_add_pd(load(), c.load()));
+		return *this;
+	}
+
+	Coord3 operator*(const double m) const
+	{
+		return Coord3<double>(_mm256_mul_pd(load(), _mm256_set1_pd(m)));
+	}
+
+	Coord3 operator*(const Coord3<double>& m) const
+	{
+		return Coord3<double>(_mm256_mul_pd(load(), m.load()));
+	}
+
+	Coord3& operator*=(const double& m)
+	{
+		store(_mm256_mul_pd(load(), _mm256_set1_pd(m)));
+		return *this;
+	}
+
+	Coord3& operator*=(const Coord3<double>& m)
+	{
+		store(_mm256_mul_pd(load(), m.load()));
+		return *this;
+	}
+
+	Coord3 operator/(const double m) const
+	{
+		return Coord3<double>(_mm256_div_pd(load(), _mm256_set1_pd(m)));
+	}
+
+	Coord3 operator/(const Coord3<double>& m) const
+	{
+		return Coord3<double>(maskPad(_mm256_div_pd(load(), m.load())));
+	}
+
+	Coord3 operator/=(const double& d)
+	{
+		store(_mm256_div_pd(load(), _mm256_set1_pd(d)));
+		return *this;
+	}
+
+	Coord3& operator/=(const Coord3<double>& m)
+	{
+		store(maskPad(_mm256_div_pd(load(), m.load())));
+		return *this;
+	}
+
+	double len(void) const
+	{
+		return sqrt(dot(*this));
+	}
+
+	Coord3 cross(const Coord3<double>& v) const
+	{
+#ifdef __AVX2__
+		__m256d a = load();
+		__m256d b = v.load();
+		__m256d a_yzx = _mm256_permute4x64_pd(a, _MM_SHUFFLE(3, 0, 2, 1));
+		__m256d b_yzx = _mm256_permute4x64_pd(b, _MM_SHUFFLE(3, 0, 2, 1));
+		__m256d c = _mm256_sub_pd(_mm256_mul_pd(a, b_yzx), _mm256_mul_pd(a_yzx, b));
+		return Coord3<double>(_mm256_permute4x64_pd(c, _MM_SHUFFLE(3, 0, 2, 1)));
+#else
+		// AVX has no cross-lane permute for doubles, so the scalar form
+		// is quicker here
+		return Coord3<double>(y * v.z - z * v.y,
+							  z * v.x - x * v.z,
+							  x * v.y - y * v.x);
+#endif
+	}
+
+	Coord3& cross(const Coord3<double>& v1, const Coord3<double>& v2)
+	{
+		*this = v1.cross(v2);
+		return *this;
+	}
+
+	double dot(const Coord3<double>& v) const
+	{
+		__m256d m  = _mm256_mul_pd(load(), v.load());
+		__m128d lo = _mm256_castpd256_pd128(m);
+		__m128d hi = _mm256_extractf128_pd(m, 1);
+		__m128d s  = _mm_add_sd(lo, _mm_unpackhi_pd(lo, lo));
+		return _mm_cvtsd_f64(_mm_add_sd(s, hi));
+	}
+
+	double angle(const Coord3<double>& v) const
+	{
+		return acos(dot(v) / (len() + v.len()));
+	}
+
+	Coord3& normalise(void)
+	{
+		store(_mm256_div_pd(load(), _mm256_set1_pd(len())));
+		return *this;
+	}
+
+	Coord3 unit(void) const
+	{
+		return Coord3<double>(_mm256_div_pd(load(), _mm256_set1_pd(len())));
+	}
+
+	bool isZero(void) const
+	{
+		return x == 0 && y == 0 && z == 0;
+	}
+
+	/** linearly interpolates between this Coord and Coord t1, such:
+	 *      this = (1 - alpha) * this + alpha * t1 */
+	void interpolate(const Coord3<double>& t1, double alpha)
+	{
+		store(lerp(t1, alpha).load());
+	}
+
+	/** returns (1 - alpha) * this + alpha * t1 */
+	Coord3 lerp(const Coord3<double>& t1, double alpha) const
+	{
+		__m256d a = load();
+		return Coord3<double>(_mm256_add_pd(a, _mm256_mul_pd(_mm256_sub_pd(t1.load(), a), _mm256_set1_pd(alpha))));
+	}
+
+private:
+	explicit Coord3(__m256d v)
+	{
+		store(v);
+	}
+
+	__m256d load(void) const
+	{
+		return _mm256_loadu_pd(&x);
+	}
+
+	void store(__m256d v)
+	{
+		_mm256_storeu_pd(&x, v);
+	}
+
+	static __m256d maskPad(__m256d v)
+	{
+		return _mm256_blend_pd(v, _mm256_setzero_pd(), 8);
+	}
+};
+
+#endif // LK_COORD_AVX
+
+
+#endif
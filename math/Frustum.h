@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ *
+ */
+
+#ifndef Frustum_h
+#define Frustum_h
+
+#include "math/Box3.h"
+#include "math/Coord.h"
+#include "math/Matrix4.h"
+
+
+/** the six clipping planes of a view volume. Each plane is stored as
+ *  (a, b, c, d) in a Coord4, with points p inside the plane satisfying
+ *  a*p.x + b*p.y + c*p.z + d >= 0 */
+template <class T>
+struct Frustum {
+	enum Plane {LEFT, RIGHT, BOTTOM, TOP, NEAR_PLANE, FAR_PLANE};
+
+	Coord4<T> planes[6];
+
+	/** constructs a frustum that contains everything */
+	Frustum()
+	{
+		for (int i = 0; i < 6; i++)
+			planes[i] = Coord4<T>(0, 0, 0, 1);
+	}
+
+	/** extracts the planes of the view volume of m, which is usually
+	 *  projection * modelview. The planes are in the coordinate frame
+	 *  that m maps from */
+	explicit Frustum(const Matrix4<T>& m)
+	{
+		for (int i = 0; i < 3; i++){
+			planes[2*i] = Coord4<T>(
+				m(3, 0) + m(i, 0), m(3, 1) + m(i, 1), m(3, 2) + m(i, 2), m(3, 3) + m(i, 3));
+			planes[2*i + 1] = Coord4<T>(
+				m(3, 0) - m(i, 0), m(3, 1) - m(i, 1), m(3, 2) - m(i, 2), m(3, 3) - m(i, 3));
+		}
+	}
+
+	bool contains(const Coord3<T>& p) const
+	{
+		for (int i = 0; i < 6; i++){
+			const Coord4<T>& n = planes[i];
+			if (n.t * p.x + n.u * p.y + n.v * p.z + n.w < 0)
+				return false;
+		}
+		return true;
+	}
+
+	/** returns false if b lies entirely outside one of the planes. This
+	 *  is conservative: a large box near a corner of the frustum may be
+	 *  reported as intersecting when it does not */
+	bool intersects(const Box3<T>& b) const
+	{
+		if (b.isEmpty())
+			return false;
+		for (int i = 0; i < 6; i++){
+			const Coord4<T>& n = planes[i];
+			// the corner of the box furthest along the plane normal
+			T x = n.t >= 0 ? b.max.x : b.min.x;
+			T y = n.u >= 0 ? b.max.y : b.min.y;
+			T z = n.v >= 0 ? b.max.z : b.min.z;
+			if (n.t * x + n.u * y + n.v * z + n.w < 0)
+				return false;
+		}
+		return true;
+	}
+};
+
+typedef Frustum<float>  Frustumf;
+typedef Frustum<double> Frustumd;
+
+
+#endif
@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2008 University of South Australia
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Contributors:
+ *   Andrew Cunningham <andrewcunningham@mac.com>
+ *
+ */
+
+#ifndef Matrix4_h
+#define Matrix4_h
+
+#include <cmath>
+#include <sstream>
+#include "math/Coord.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+
+/** a 4x4 transformation matrix. Elements are stored in column-major
+ *  order so that m can be handed directly to glLoadMatrix/glMultMatrix */
+template <class T>
+struct Matrix4 {
+	T m[16];
+
+	/** constructs the identity matrix */
+	Matrix4()
+	{
+		setIdentity();
+	}
+
+	Matrix4(const T* v)
+	{
+		for (int i = 0; i < 16; i++)
+			m[i] = v[i];
+	}
+
+	Matrix4(const Matrix4<T>& orig)
+	{
+		for (int i = 0; i < 16; i++)
+			m[i] = orig.m[i];
+	}
+
+	Matrix4& operator=(const Matrix4<T>& orig)
+	{
+		for (int i = 0; i < 16; i++)
+			m[i] = orig.m[i];
+		return *this;
+	}
+
+	/** returns the element at the specified row and column */
+	T& operator()(int row, int col)
+	{
+		return m[col * 4 + row];
+	}
+
+	const T& operator()(int row, int col) const
+	{
+		return m[col * 4 + row];
+	}
+
+	void setIdentity(void)
+	{
+		for (int i = 0; i < 16; i++)
+			m[i] = 0;
+		m[0] = m[5] = m[10] = m[15] = 1;
+	}
+
+	Matrix4 operator*(const Matrix4<T>& b) const
+	{
+		Matrix4<T> r;
+		for (int c = 0; c < 4; c++){
+			const T* bc = &b.m[c * 4];
+			for (int i = 0; i < 4; i++)
+				r.m[c * 4 + i] = m[i] * bc[0] + m[4 + i] * bc[1] + m[8 + i] * bc[2] + m[12 + i] * bc[3];
+		}
+		return r;
+	}
+
+	Matrix4& operator*=(const Matrix4<T>& b)
+	{
+		*this = *this * b;
+		return *this;
+	}
+
+	/** transforms the point p (with an implied w of 1) */
+	Coord3<T> transformPoint(const Coord3<T>& p) const
+	{
+		return Coord3<T>(m[0] * p.x + m[4] * p.y + m[8]  * p.z + m[12],
+						 m[1] * p.x + m[5] * p.y + m[9]  * p.z + m[13],
+						 m[2] * p.x + m[6] * p.y + m[10] * p.z + m[14]);
+	}
+
+	/** transforms the direction d (with an implied w of 0) */
+	Coord3<T> transformVector(const Coord3<T>& d) const
+	{
+		return Coord3<T>(m[0] * d.x + m[4] * d.y + m[8]  * d.z,
+						 m[1] * d.x + m[5] * d.y + m[9]  * d.z,
+						 m[2] * d.x + m[6] * d.y + m[10] * d.z);
+	}
+
+	/** post-multiplies this matrix by a translation, as glTranslate does */
+	Matrix4& translate(T x, T y, T z)
+	{
+		m[12] += m[0] * x + m[4] * y + m[8]  * z;
+		m[13] += m[1] * x + m[5] * y + m[9]  * z;
+		m[14] += m[2] * x + m[6] * y + m[10] * z;
+		m[15] += m[3] * x + m[7] * y + m[11] * z;
+		return *this;
+	}
+
+	/** post-multiplies this matrix by a scale, as glScale does */
+	Matrix4& scale(T x, T y, T z)
+	{
+		for (int i = 0; i < 4; i++){
+			m[i]     *= x;
+			m[4 + i] *= y;
+			m[8 + i] *= z;
+		}
+		return *this;
+	}
+
+	/** post-multiplies this matrix by a rotation of degrees about the
+	 *  x axis, as glRotate(degrees, 1, 0, 0) does */
+	Matrix4& rotateX(T degrees)
+	{
+		if (degrees == 0)
+			return *this;
+		T r = degrees * M_PI / 180.0;
+		T c = cos(r);
+		T s = sin(r);
+		for (int i = 0; i < 4; i++){
+			T a = m[4 + i];
+			T b = m[8 + i];
+			m[4 + i] = a * c + b * s;
+			m[8 + i] = b * c - a * s;
+		}
+		return *this;
+	}
+
+	/** post-multiplies this matrix by a rotation of degrees about the
+	 *  y axis, as glRotate(degrees, 0, 1, 0) does */
+	Matrix4& rotateY(T degrees)
+	{
+		if (degrees == 0)
+			return *this;
+		T r = degrees * M_PI / 180.0;
+		T c = cos(r);
+		T s = sin(r);
+		for (int i = 0; i < 4; i++){
+			T a = m[i];
+			T b = m[8 + i];
+			m[i]     = a * c - b * s;
+			m[8 + i] = a * s + b * c;
+		}
+		return *this;
+	}
+
+	/** post-multiplies this matrix by a rotation of degrees about the
+	 *  z axis, as glRotate(degrees, 0, 0, 1) does */
+	Matrix4& rotateZ(T degrees)
+	{
+		if (degrees == 0)
+			return *this;
+		T r = degrees * M_PI / 180.0;
+		T c = cos(r);
+		T s = sin(r);
+		for (int i = 0; i < 4; i++){
+			T a = m[i];
+			T b = m[4 + i];
+			m[i]     = a * c + b * s;
+			m[4 + i] = b * c - a * s;
+		}
+		return *this;
+	}
+
+	/** transforms the homogeneous coordinate c, stored as (x, y, z, w) */
+	Coord4<T> transform(const Coord4<T>& c) const
+	{
+		return Coord4<T>(m[0] * c.t + m[4] * c.u + m[8]  * c.v + m[12] * c.w,
+						 m[1] * c.t + m[5] * c.u + m[9]  * c.v + m[13] * c.w,
+						 m[2] * c.t + m[6] * c.u + m[10] * c.v + m[14] * c.w,
+						 m[3] * c.t + m[7] * c.u + m[11] * c.v + m[15] * c.w);
+	}
+
+	Matrix4 transpose(void) const
+	{
+		Matrix4<T> r;
+		for (int row = 0; row < 4; row++)
+			for (int col = 0; col < 4; col++)
+				r(row, col) = (*this)(col, row);
+		return r;
+	}
+
+	/** returns the inverse of this matrix in inv. Returns false, leaving
+	 *  inv unchanged, if the matrix is singular */
+	bool inverse(Matrix4<T>& inv) const
+	{
+		T r[16];
+		r[0]  =  m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] + m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+		r[4]  = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] - m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+		r[8]  =  m[4] * m[9]  * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] + m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+		r[12] = -m[4] * m[9]  * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] - m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+		r[1]  = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] - m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+		r[5]  =  m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] + m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+		r[9]  = -m[0] * m[9]  * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] - m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+		r[13] =  m[0] * m[9]  * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] + m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+		r[2]  =  m[1] * m[6]  * m[15] - m[1] * m[7]  * m[14] - m[5] * m[2] * m[15] + m[5] * m[3] * m[14] + m[13] * m[2] * m[7]  - m[13] * m[3] * m[6];
+		r[6]  = -m[0] * m[6]  * m[15] + m[0] * m[7]  * m[14] + m[4] * m[2] * m[15] - m[4] * m[3] * m[14] - m[12] * m[2] * m[7]  + m[12] * m[3] * m[6];
+		r[10] =  m[0] * m[5]  * m[15] - m[0] * m[7]  * m[13] - m[4] * m[1] * m[15] + m[4] * m[3] * m[13] + m[12] * m[1] * m[7]  - m[12] * m[3] * m[5];
+		r[14] = -m[0] * m[5]  * m[14] + m[0] * m[6]  * m[13] + m[4] * m[1] * m[14] - m[4] * m[2] * m[13] - m[12] * m[1] * m[6]  + m[12] * m[2] * m[5];
+		r[3]  = -m[1] * m[6]  * m[11] + m[1] * m[7]  * m[10] + m[5] * m[2] * m[11] - m[5] * m[3] * m[10] - m[9]  * m[2] * m[7]  + m[9]  * m[3] * m[6];
+		r[7]  =  m[0] * m[6]  * m[11] - m[0] * m[7]  * m[10] - m[4] * m[2] * m[11] + m[4] * m[3] * m[10] + m[8]  * m[2] * m[7]  - m[8]  * m[3] * m[6];
+		r[11] = -m[0] * m[5]  * m[11] + m[0] * m[7]  * m[9]  + m[4] * m[1] * m[11] - m[4] * m[3] * m[9]  - m[8]  * m[1] * m[7]  + m[8]  * m[3] * m[5];
+		r[15] =  m[0] * m[5]  * m[10] - m[0] * m[6]  * m[9]  - m[4] * m[1] * m[10] + m[4] * m[2] * m[9]  + m[8]  * m[1] * m[6]  - m[8]  * m[2] * m[5];
+
+		T det = m[0] * r[0] + m[1] * r[4] + m[2] * r[8] + m[3] * r[12];
+		if (det == 0)
+			return false;
+		det = 1.0 / det;
+		for (int i = 0; i < 16; i++)
+			inv.m[i] = r[i] * det;
+		return true;
+	}
+
+	/** returns the inverse of this matrix in inv, assuming the bottom row
+	 *  is (0, 0, 0, 1) as it is for any combination of translations,
+	 *  rotations and scales. Cheaper than inverse(). Returns false if the
+	 *  matrix is singular */
+	bool affineInverse(Matrix4<T>& inv) const
+	{
+		// invert the upper 3x3 through its cofactors
+		T c00 = m[5] * m[10] - m[9] * m[6];
+		T c01 = m[9] * m[2]  - m[1] * m[10];
+		T c02 = m[1] * m[6]  - m[5] * m[2];
+		T det = m[0] * c00 + m[4] * c01 + m[8] * c02;
+		if (det == 0)
+			return false;
+		det = 1.0 / det;
+
+		Matrix4<T> r;
+		r.m[0]  = c00 * det;
+		r.m[1]  = c01 * det;
+		r.m[2]  = c02 * det;
+		r.m[4]  = (m[8] * m[6]  - m[4] * m[10]) * det;
+		r.m[5]  = (m[0] * m[10] - m[8] * m[2])  * det;
+		r.m[6]  = (m[4] * m[2]  - m[0] * m[6])  * det;
+		r.m[8]  = (m[4] * m[9]  - m[8] * m[5])  * det;
+		r.m[9]  = (m[8] * m[1]  - m[0] * m[9])  * det;
+		r.m[10] = (m[0] * m[5]  - m[4] * m[1])  * det;
+
+		// and the translation is the inverse rotated negated translation
+		r.m[12] = -(r.m[0] * m[12] + r.m[4] * m[13] + r.m[8]  * m[14]);
+		r.m[13] = -(r.m[1] * m[12] + r.m[5] * m[13] + r.m[9]  * m[14]);
+		r.m[14] = -(r.m[2] * m[12] + r.m[6] * m[13] + r.m[10] * m[14]);
+		inv = r;
+		return true;
+	}
+
+	static Matrix4 translation(T x, T y, T z)
+	{
+		Matrix4<T> r;
+		r.m[12] = x;
+		r.m[13] = y;
+		r.m[14] = z;
+		return r;
+	}
+
+	/** returns the projection matrix gluPerspective would produce. fovy
+	 *  is in degrees */
+	static Matrix4 perspective(T fovy, T aspect, T zNear, T zFar)
+	{
+		T f = 1.0 / tan(fovy * M_PI / 360.0);
+		Matrix4<T> r;
+		r.m[0]  = f / aspect;
+		r.m[5]  = f;
+		r.m[10] = (zFar + zNear) / (zNear - zFar);
+		r.m[11] = -1;
+		r.m[14] = 2 * zFar * zNear / (zNear - zFar);
+		r.m[15] = 0;
+		return r;
+	}
+};
+
+/** maps obj to window coordinates, as gluProject does. Returns false if
+ *  the point cannot be projected */
+template <class T>
+bool projectPoint(const Coord3<T>& obj, const Matrix4<T>& modelview, const Matrix4<T>& projection,
+				  const int viewport[4], Coord3<T>& win)
+{
+	Coord4<T> v = projection.transform(modelview.transform(Coord4<T>(obj.x, obj.y, obj.z, 1)));
+	if (v.w == 0)
+		return false;
+	win.set(viewport[0] + viewport[2] * (v.t / v.w + 1) / 2,
+			viewport[1] + viewport[3] * (v.u / v.w + 1) / 2,
+			(v.v / v.w + 1) / 2);
+	return true;
+}
+
+/** maps win, in window coordinates, back to object coordinates as
+ *  gluUnProject does. invModelviewProjection is the inverse of
+ *  projection * modelview. Returns false if the point cannot be mapped */
+template <class T>
+bool unprojectPoint(const Coord3<T>& win, const Matrix4<T>& invModelviewProjection,
+					const int viewport[4], Coord3<T>& obj)
+{
+	Coord4<T> v = invModelviewProjection.transform(
+		Coord4<T>((win.x - viewport[0]) / viewport[2] * 2 - 1,
+				  (win.y - viewport[1]) / viewport[3] * 2 - 1,
+				  win.z * 2 - 1,
+				  1));
+	if (v.w == 0)
+		return false;
+	obj.set(v.t / v.w, v.u / v.w, v.v / v.w);
+	return true;
+}
+
+template <class T>
+std::ostream& operator<<( std::ostream& os, const Matrix4<T>& t ){
+	for (int row = 0; row < 4; row++)
+		os << t(row, 0) << " " << t(row, 1) << " " << t(row, 2) << " " << t(row, 3) << std::endl;
+	return os;
+}
+
+typedef Matrix4<float>  Matrix4f;
+typedef Matrix4<double> Matrix4d;
+
+
+#endif